@@ -5,15 +5,107 @@
 #include <iterator>
 #include <functional>
 #include <istream>
+#include <string>
+#include <string_view>
 #include <array>
 #include <tuple>
 #include <limits>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <cmath>
 
 namespace Enumerable {
 
+struct write_options;
+struct cache_options;
+
+// Statistics of a parallel run
+struct par_stats {
+  size_t chunks = 0; // Chunks processed
+  size_t splits = 0; // Tasks split off for other threads
+  size_t steals = 0; // Tasks run by another thread than the one which created them
+  size_t grain  = 0; // Grain size (elements per chunk) at the end of the run
+};
+
+// Execution policy of the parallel operations, e.g. e.each(par, f)
+// or e.each(par(4), f). Requires Enumerable/parallel.hpp.
+struct par_t {
+  unsigned   threads = 0;       // Maximum number of threads, 0 for the whole pool
+  size_t     grain   = 0;       // Elements per chunk, 0 to adapt it to the measured cost
+  par_stats* stats   = nullptr; // If not null, filled at the end of the run
+  constexpr par_t operator()(unsigned t, size_t g = 0, par_stats* s = nullptr) const { return par_t{t, g, s}; }
+};
+inline constexpr par_t par {};
+
+// Order of the operations in sum() and product() on floating point
+// numbers. Integers are always reassociated (the result is the same).
+enum class reduction {
+  ordered,     // Left to right, as inject
+  reassociate, // Several independent accumulators, combined at the end
+  pairwise,    // Blocks combined as a balanced tree: error in O(log n)
+  compensated, // Neumaier summation: error independent of n. sum() only.
+  reproducible  // Blocks of reproducible_block positions of the source, combined as a
+                // balanced tree: the same result in parallel whatever the threads and grain
+};
+constexpr size_t reproducible_block = 4096;
+
+// Associative operation op with its identity element, for
+// reduce(). If commutative, the elements may be combined in any
+// order, with several independent accumulators.
+template<typename T, typename Op>
+struct monoid {
+  T    identity;
+  Op   op;
+  bool commutative = false;
+  T operator()(const T& x, const T& y) const { return op(x, y); }
+};
+template<typename T, typename Op>
+monoid<T, Op> make_monoid(T identity, Op op, bool commutative = false) { return monoid<T, Op>{ identity, op, commutative }; }
+
 namespace imp {
 template<typename Enum, typename Block> class Map;
 template<typename Enum, typename Block> class Select;
+template<typename Enum, typename Block> class FilterMap;
+template<typename Enum, typename Set> class SelectIn;
+template<typename T, typename Hash> class Bloom;
+template<typename Enum> class Fields;
+template<typename T> class RecordOutput;
+template<typename Enum> struct LinePrinter;
+template<typename Enum> class Probe;
+template<typename Enum> class Cache;
+template<typename Enum, typename Body> void parallel_chunks(Enum& e, const par_t& p, Body body);
+template<typename F> void parallel_for(size_t n, unsigned threads, F f);
+
+// A splittable enumerable can be cut in chunks processed in
+// parallel. It has size(), the number of elements left in the
+// underlying source, split(n), which detaches the next n source
+// elements in a new enumerable of the same type, and start(), to
+// call on a chunk before iterating it.
+template<typename Enum, typename = void>
+struct is_splittable : std::false_type { };
+template<typename Enum>
+struct is_splittable<Enum, std::void_t<decltype(std::declval<const Enum&>().size()),
+                                       decltype(std::declval<Enum&>().split((size_t)0)),
+                                       decltype(std::declval<Enum&>().start())>>
+  : std::true_type { };
+
+// A splittable enumerable has an exact size if size() is the number
+// of elements it yields (i.e. no Select)
+template<typename Enum, typename = void>
+struct has_exact_size : std::false_type { };
+template<typename Enum>
+struct has_exact_size<Enum, typename std::enable_if<Enum::exact_size>::type> : is_splittable<Enum> { };
 
 template<typename Block>
 class Not {
@@ -47,33 +139,214 @@ struct apply : public apply<Block, T, N-1, N-1, Ns...>
 
 template<typename Block, typename T, size_t... Ns>
 struct apply<Block, T, 0, Ns...> {
-  static auto call(Block b, const T& t) { return b(std::get<Ns>(t)...); }
+  static auto call(Block& b, const T& t) { return b(std::get<Ns>(t)...); }
   template<typename U>
-  static auto call2(Block b, U&& x, const T& t) { return b(x, std::get<Ns>(t)...); }
+  static auto call2(Block& b, U&& x, const T& t) { return b(std::forward<U>(x), std::get<Ns>(t)...); }
 };
 
+// True if the block accepts the accumulator A as an rvalue, followed
+// by the element X (unpacked if a tuple)
+template<typename Block, typename A, typename X>
+struct accepts_rvalue : std::is_invocable<Block&, A&&, const X&> { };
+template<typename Block, typename A, typename... Ts>
+struct accepts_rvalue<Block, A, std::tuple<Ts...>> : std::is_invocable<Block&, A&&, const Ts&...> { };
+
 // Base. It uses CRTP. A derived class must have a prefix ++ operator,
 // the dereference * operator and a cast to bool operator, returning
 // false if the enumerable has no more elements.
+// A stage reading another enumerable returns it with upstream(), so
+// that a probe finds the probe upstream of it.
 template<typename Derived, typename T>
 class Base {
 protected:
+  // The block is passed by reference and the elements of a tuple are
+  // unpacked as they are (references stay references): no copies.
   template<typename Block, typename... Ts>
-  inline auto call_block(Block b, const std::tuple<Ts...>& x) {
+  inline auto call_block(Block& b, const std::tuple<Ts...>& x) {
     return apply<Block, std::tuple<Ts...>>::call(b, x);
   }
   template<typename Block, typename U, typename... Ts>
-  inline auto call_block(Block b, U&& a, const std::tuple<Ts...>& x) {
+  inline auto call_block(Block& b, U&& a, const std::tuple<Ts...>& x) {
     return apply<Block, std::tuple<Ts...>>::call2(b, std::forward<U>(a), x);
   }
   template<typename Block, typename U>
-  inline auto call_block(Block b, const U& x) {
+  inline auto call_block(Block& b, const U& x) {
     return b(x);
   }
   template<typename Block, typename U, typename V>
-  inline auto call_block(Block b, U&& x, const V& y) {
+  inline auto call_block(Block& b, U&& x, const V& y) {
     return b(std::forward<U>(x), y);
   }
+
+  // Apply f to every chunk in parallel, and combine the results in
+  // the order of the chunks, starting from start.
+  template<typename U, typename F, typename Combine>
+  U reduce_chunks(const par_t& p, const U& start, F f, Combine combine) {
+    auto&                             self = *static_cast<Derived*>(this);
+    std::vector<std::pair<size_t, U>> parts;
+    std::mutex                        mtx;
+    parallel_chunks(self, p, [&](Derived& chunk, size_t offset) {
+        U r = f(chunk);
+        std::lock_guard<std::mutex> lock(mtx);
+        parts.emplace_back(offset, std::move(r));
+      });
+    std::sort(parts.begin(), parts.end(), [](const auto& x, const auto& y) { return x.first < y.first; });
+    U acc(start);
+    for(auto& r : parts)
+      acc = combine(std::move(acc), std::move(r.second));
+    return acc;
+  }
+
+  // Fold the elements into the K = sizeof...(I) accumulators in turn,
+  // which the compiler keeps in registers: K independent dependency
+  // chains instead of one. Stop after rounds rounds of K elements;
+  // return false if there are no elements left.
+  template<typename U, typename Op, size_t... I>
+  bool fold_lanes(std::array<U, sizeof...(I)>& acc, Op& op, size_t rounds, std::index_sequence<I...>) {
+    auto& self = *static_cast<Derived*>(this);
+    auto  step = [&](U& a) {
+      if(!self) return false;
+      a = op(a, *self);
+      ++self;
+      return true;
+    };
+    bool more = true;
+    for(size_t r = 0; more && r < rounds; ++r)
+      ((more = more && step(acc[I])), ...);
+    return more;
+  }
+  template<size_t K, typename U, typename Op>
+  U fold_lanes(const U& identity, Op op) {
+    std::array<U, K> acc;
+    acc.fill(identity);
+    fold_lanes(acc, op, std::numeric_limits<size_t>::max(), std::make_index_sequence<K>());
+    for(size_t k = 1; k < K; ++k)
+      acc[0] = op(acc[0], acc[k]);
+    return acc[0];
+  }
+
+  // Pairwise summation: blocks of 256 elements are summed with 8
+  // accumulators, and the block sums are combined as in a balanced
+  // binary tree, keeping one partial sum per level.
+  template<typename U, typename Op>
+  U pairwise(const U& identity, Op op) {
+    auto&  self = *static_cast<Derived*>(this);
+    U      levels[64];
+    size_t top = 0, blocks = 0;
+    for(bool more = true; more && self; ) {
+      std::array<U, 8> acc;
+      acc.fill(identity);
+      more = fold_lanes(acc, op, 256 / 8, std::make_index_sequence<8>());
+      U x = op(op(op(acc[0], acc[1]), op(acc[2], acc[3])), op(op(acc[4], acc[5]), op(acc[6], acc[7])));
+      for(size_t c = blocks++; c & 1; c >>= 1)
+        x = op(levels[--top], x);
+      levels[top++] = x;
+    }
+    U res = identity;
+    while(top > 0)
+      res = op(levels[--top], res);
+    return res;
+  }
+
+  // Neumaier summation: a compensation term accumulates the low order
+  // bits lost in each addition. 4 independent accumulators.
+  template<typename U>
+  U compensated() {
+    struct acc_type { U sum, c; };
+    auto add = [](acc_type a, U x) {
+      const bool first = std::abs(a.sum) >= std::abs(x);
+      const U    big   = first ? a.sum : x;
+      const U    small = first ? x : a.sum;
+      const U    t     = a.sum + x;
+      a.c  += (big - t) + small;
+      a.sum = t;
+      return a;
+    };
+    std::array<acc_type, 4> acc;
+    acc.fill(acc_type { 0, 0 });
+    fold_lanes(acc, add, std::numeric_limits<size_t>::max(), std::make_index_sequence<4>());
+    for(size_t k = 1; k < acc.size(); ++k) {
+      acc[0]    = add(acc[0], acc[k].sum);
+      acc[0].c += acc[k].c;
+    }
+    return acc[0].sum + acc[0].c;
+  }
+
+  // Fold the next rounds * 8 elements with 8 accumulators, combined
+  // in a fixed order.
+  template<typename U, typename Op>
+  U fold_block(const U& identity, Op& op, size_t rounds) {
+    std::array<U, 8> acc;
+    acc.fill(identity);
+    fold_lanes(acc, op, rounds, std::make_index_sequence<8>());
+    return op(op(op(acc[0], acc[1]), op(acc[2], acc[3])), op(op(acc[4], acc[5]), op(acc[6], acc[7])));
+  }
+
+  // Fold every block of reproducible_block positions of the source
+  // into out, which has room for one result per block (at least
+  // one). The blocks are split off, so that the positions, not the
+  // elements selected, delimit them.
+  template<typename U, typename Op>
+  void fold_blocks(const U& identity, Op& op, U* out) {
+    auto& self = *static_cast<Derived*>(this);
+    do {
+      Derived block = self.split(reproducible_block);
+      block.start();
+      *out++ = block.fold_block(identity, op, std::numeric_limits<size_t>::max());
+    } while(self.size() > 0);
+  }
+
+  // Reproducible reduction: the results of the blocks depend only on
+  // the source and are combined as a balanced tree over the number of
+  // blocks.
+  template<typename U, typename Op>
+  static U combine_blocks(std::vector<U>& res, Op& op) {
+    for(size_t n = res.size(); n > 1; n = (n + 1) / 2)
+      for(size_t i = 0; i < n; i += 2)
+        res[i / 2] = i + 1 < n ? op(res[i], res[i + 1]) : res[i];
+    return res[0];
+  }
+  template<typename U, typename Op>
+  U reproducible(const U& identity, Op op) {
+    auto&          self = *static_cast<Derived*>(this);
+    std::vector<U> res;
+    if constexpr(is_splittable<Derived>::value) {
+      res.resize(std::max((size_t)1, (self.size() + reproducible_block - 1) / reproducible_block), identity);
+      fold_blocks(identity, op, res.data());
+    } else {
+      do {
+        res.push_back(fold_block(identity, op, reproducible_block / 8));
+      } while(self);
+    }
+    return combine_blocks(res, op);
+  }
+  // In parallel, the chunks are whole blocks
+  template<typename U, typename Op>
+  U reproducible(const par_t& p, const U& identity, Op op) {
+    if constexpr(!is_splittable<Derived>::value)
+      return reproducible(identity, op);
+    auto&          self   = *static_cast<Derived*>(this);
+    const size_t   blocks = std::max((size_t)1, (self.size() + reproducible_block - 1) / reproducible_block);
+    std::vector<U> res(blocks, identity);
+    par_t          q = p;
+    q.grain = (p.grain ? (p.grain + reproducible_block - 1) / reproducible_block : std::max((size_t)1, blocks / 64))
+      * reproducible_block;
+    parallel_chunks(self, q, [&](Derived& chunk, size_t offset) {
+        chunk.fold_blocks(identity, op, &res[offset / reproducible_block]);
+      });
+    return combine_blocks(res, op);
+  }
+
+  template<typename U, typename Op>
+  U reduce_with(const U& identity, Op op, reduction mode) {
+    if(std::is_integral<U>::value || mode == reduction::reassociate)
+      return fold_lanes<8>(identity, op);
+    if(mode == reduction::reproducible)
+      return reproducible(identity, op);
+    if(mode == reduction::pairwise)
+      return pairwise(identity, op);
+    return inject(identity, op);
+  }
 public:
   typedef T value_type;
   template<typename Block>
@@ -83,19 +356,72 @@ public:
       call_block(b, *self);
   }
 
+  // Call b on every element, in parallel and in no particular
+  // order. Serial if the enumerable is not splittable.
+  template<typename Block>
+  void each(const par_t& p, Block b) {
+    auto& self = *static_cast<Derived*>(this);
+    parallel_chunks(self, p, [&](Derived& chunk, size_t) { chunk.each(b); });
+  }
+
   template<typename Block>
   Map<Derived, Block> map(Block b) {
     auto& self = *static_cast<Derived*>(this);
     return Map<Derived, Block>(self, b);
   }
 
+  // The accumulator is moved into the block and back: a block taking
+  // it by value and returning it does no copy. It is passed as an
+  // lvalue to a block taking it by non-const reference.
   template<typename Block, typename U>
-  U inject(U&& start, Block b) {
+  typename std::decay<U>::type inject(U&& start, Block b) {
+    typedef typename std::decay<U>::type acc_type;
+    auto&                                self = *static_cast<Derived*>(this);
+    acc_type                             acc(std::forward<U>(start));
+    if constexpr(accepts_rvalue<Block, acc_type, typename std::decay<decltype(*self)>::type>::value) {
+      for( ; self; ++self)
+        acc = call_block(b, std::move(acc), *self);
+    } else {
+      for( ; self; ++self)
+        acc = call_block(b, acc, *self);
+    }
+    return acc;
+  }
+
+  // Call b(obj, x) for every element x, where b modifies obj in
+  // place. Return obj: a reference if obj is an lvalue, otherwise the
+  // object moved out.
+  template<typename U, typename Block>
+  U each_with_object(U&& obj, Block b) {
     auto& self = *static_cast<Derived*>(this);
-    auto  acc  = std::forward<U>(start);
+    U     acc(std::forward<U>(obj));
     for( ; self; ++self)
-      acc = call_block(b, acc, *self);
-    return acc;
+      call_block(b, acc, *self);
+    return std::forward<U>(acc);
+  }
+
+  // Run the reducers (see namespace reducer) over the elements in a
+  // single pass, e.g. lines(is).fanout(reducer::count(),
+  // reducer::max()). Return the tuple of their results.
+  template<typename... Reducers>
+  auto fanout(Reducers... rs) {
+    typedef typename std::decay<value_type>::type x_type;
+    auto& self = *static_cast<Derived*>(this);
+    auto  accs = std::make_tuple(rs.template bind<x_type>()...);
+    for( ; self; ++self) {
+      const auto& x = *self;
+      std::apply([&x](auto&... a) { (a(x), ...); }, accs);
+    }
+    return std::apply([](auto&... a) { return std::tuple<decltype(a.result())...>(a.result()...); }, accs);
+  }
+
+  // Inject every chunk in parallel starting from start, then combine
+  // the results of the chunks in order: combine(combine(r0, r1),
+  // r2)... start must be an identity for combine, and combine must be
+  // associative. Serial if the enumerable is not splittable.
+  template<typename U, typename Block, typename Combine>
+  U inject(const par_t& p, const U& start, Block b, Combine combine) {
+    return reduce_chunks(p, start, [&](Derived& chunk) { return chunk.inject(U(start), b); }, combine);
   }
 
   // template<typename Block>
@@ -115,6 +441,102 @@ public:
   template<typename Container>
   auto collect(Container& c) { return output(std::back_inserter(c)); }
 
+  // Append the elements to the vector-like container c, in parallel
+  // and in order. With an exact size, c is resized once and every
+  // chunk writes directly to its final position. Otherwise, the first
+  // chunk is appended to c and the others to their own buffer (a
+  // thread may run another chunk while waiting in a nested parallel
+  // operation), moved to their position after a prefix sum of their
+  // sizes. Serial if the enumerable is not splittable.
+  template<typename Container>
+  void collect(const par_t& p, Container& c) {
+    auto&        self = *static_cast<Derived*>(this);
+    const size_t base = c.size();
+    if constexpr(has_exact_size<Derived>::value) {
+      const size_t total = self.size();
+      c.resize(base + total);
+      parallel_chunks(self, p, [&](Derived& chunk, size_t offset) {
+          auto it = c.begin() + base + offset;
+          for(size_t n = std::min(chunk.size(), total - offset); n > 0 && chunk; --n, ++chunk, ++it)
+            *it = *chunk;
+        });
+    } else {
+      struct segment {
+        size_t     offset;
+        Container* buffer;
+      };
+      std::deque<Container> buffers; // Stable addresses
+      std::vector<segment>  segments;
+      std::mutex            mtx;
+      parallel_chunks(self, p, [&](Derived& chunk, size_t offset) {
+          if(offset == 0) {
+            for( ; chunk; ++chunk)
+              c.push_back(*chunk);
+            return;
+          }
+          Container* out;
+          {
+            std::lock_guard<std::mutex> lock(mtx);
+            buffers.emplace_back();
+            out = &buffers.back();
+            segments.push_back(segment{ offset, out });
+          }
+          for( ; chunk; ++chunk)
+            out->push_back(*chunk);
+        });
+      if(segments.empty())
+        return;
+
+      std::sort(segments.begin(), segments.end(), [](const segment& x, const segment& y) { return x.offset < y.offset; });
+      std::vector<size_t> dest(segments.size() + 1, c.size());
+      for(size_t i = 0; i < segments.size(); ++i)
+        dest[i + 1] = dest[i] + segments[i].buffer->size();
+      c.resize(dest.back());
+      parallel_for(segments.size(), p.threads ? p.threads : std::numeric_limits<unsigned>::max(), [&](size_t i) {
+          auto& b = *segments[i].buffer;
+          std::move(b.begin(), b.end(), c.begin() + dest[i]);
+        });
+    }
+  }
+
+  // Write the elements (trivially copyable) in binary to the file
+  // path. Return the number of records written. Requires
+  // Enumerable/io.hpp.
+  template<typename U = T, typename Options = write_options>
+  size_t write_records(const std::string& path, const Options& opts = Options()) {
+    typedef RecordOutput<typename std::remove_const<U>::type> output_type;
+    typename output_type::writer_type writer(path, opts);
+    output(output_type(writer));
+    writer.close();
+    return writer.written() / sizeof(U);
+  }
+
+  // Write the elements, one per line, to the file descriptor fd, the
+  // file path or the stream os. The text is formatted in a buffer of
+  // buffer_size bytes, written once full. Return the number of
+  // lines. Requires Enumerable/io.hpp.
+  size_t write_lines(int fd, size_t buffer_size = 1 << 16) {
+    auto& self = *static_cast<Derived*>(this);
+    return LinePrinter<Derived>::to_fd(self, fd, buffer_size);
+  }
+  size_t write_lines(const std::string& path, size_t buffer_size = 1 << 16) {
+    auto& self = *static_cast<Derived*>(this);
+    return LinePrinter<Derived>::to_path(self, path, buffer_size);
+  }
+  size_t print(std::ostream& os, size_t buffer_size = 1 << 16) {
+    auto& self = *static_cast<Derived*>(this);
+    return LinePrinter<Derived>::to_stream(self, os, buffer_size);
+  }
+
+  // Store the elements as they are enumerated, in a handle whose
+  // copies can enumerate them again (see Cache::replay). Requires
+  // Enumerable/cache.hpp.
+  template<typename Options = cache_options>
+  Cache<Derived> cache(const Options& opts = Options()) {
+    auto& self = *static_cast<Derived*>(this);
+    return Cache<Derived>(self, opts);
+  }
+
   template<typename Block>
   bool all(Block b) {
     auto& self = *static_cast<Derived*>(this);
@@ -177,6 +599,49 @@ public:
     return res;
   }
 
+  // Sum and product of the elements. See reduction for the order of
+  // the operations. In parallel, the results of the chunks are added
+  // (multiplied) in order, except with reduction::reproducible where
+  // the result is the same as serially.
+  template<typename U = typename std::decay<value_type>::type>
+  U sum(reduction mode = reduction::ordered) {
+    if constexpr(std::is_floating_point<U>::value) {
+      if(mode == reduction::compensated)
+        return compensated<U>();
+    }
+    return reduce_with(U(0), std::plus<U>(), mode);
+  }
+  template<typename U = typename std::decay<value_type>::type>
+  U sum(const par_t& p, reduction mode = reduction::ordered) {
+    if(mode == reduction::reproducible && std::is_floating_point<U>::value)
+      return reproducible(p, U(0), std::plus<U>());
+    return reduce_chunks(p, U(0), [mode](Derived& chunk) { return chunk.template sum<U>(mode); }, std::plus<U>());
+  }
+  template<typename U = typename std::decay<value_type>::type>
+  U product(reduction mode = reduction::ordered) {
+    if(mode == reduction::pairwise || mode == reduction::compensated)
+      mode = reduction::reassociate;
+    return reduce_with(U(1), std::multiplies<U>(), mode);
+  }
+  template<typename U = typename std::decay<value_type>::type>
+  U product(const par_t& p, reduction mode = reduction::ordered) {
+    if(mode == reduction::reproducible && std::is_floating_point<U>::value)
+      return reproducible(p, U(1), std::multiplies<U>());
+    return reduce_chunks(p, U(1), [mode](Derived& chunk) { return chunk.template product<U>(mode); }, std::multiplies<U>());
+  }
+
+  // Combine the elements with the monoid m (see make_monoid): with
+  // several accumulators if it is commutative, otherwise in order. In
+  // parallel, the results of the chunks are combined in order with m.
+  template<typename U, typename Op>
+  U reduce(const monoid<U, Op>& m) {
+    return m.commutative ? fold_lanes<8>(m.identity, m.op) : inject(m.identity, m.op);
+  }
+  template<typename U, typename Op>
+  U reduce(const par_t& p, const monoid<U, Op>& m) {
+    return reduce_chunks(p, m.identity, [&m](Derived& chunk) { return chunk.reduce(m); }, m.op);
+  }
+
   template<typename Block>
   Select<Derived, Block> select(Block b) {
     auto& self = *static_cast<Derived*>(this);
@@ -184,9 +649,59 @@ public:
   }
 
   template<typename Block>
-  Select<Derived, Not<Block>> reject(Block b) {
+  auto reject(Block b) {
+    auto& self = *static_cast<Derived*>(this);
+    return self.select(Not<Block>(b));
+  }
+
+  // Map and select at once: b returns a std::optional, and the
+  // elements are the values of the engaged optionals
+  template<typename Block>
+  FilterMap<Derived, Block> filter_map(Block b) {
+    auto& self = *static_cast<Derived*>(this);
+    return FilterMap<Derived, Block>(self, b);
+  }
+
+  // Count the elements and sample the time spent upstream, reported
+  // under name (see Enumerable/probe.hpp). No-op if
+  // ENUMERABLE_NO_PROBES is defined.
+#ifdef ENUMERABLE_NO_PROBES
+  template<typename Name>
+  Derived& probe(const Name&) {
+    return *static_cast<Derived*>(this);
+  }
+#else
+  Probe<Derived> probe(const std::string& name) {
+    auto& self = *static_cast<Derived*>(this);
+    return Probe<Derived>(self, name);
+  }
+#endif
+
+  // Keep the elements found in the set s (e.g. a Bloom filter, see
+  // Enumerable/bloom.hpp). The set is probed by batches of elements
+  // and is not copied: it must outlive the returned enumerable.
+  template<typename Set>
+  SelectIn<Derived, Set> select_in(const Set& s) {
+    auto& self = *static_cast<Derived*>(this);
+    return SelectIn<Derived, Set>(self, s);
+  }
+
+  // Split every line (std::string or std::string_view) into fields
+  // separated by sep. Requires Enumerable/text.hpp.
+  Fields<Derived> fields(char sep, char quote = '"') {
+    auto& self = *static_cast<Derived*>(this);
+    return Fields<Derived>(self, sep, quote);
+  }
+
+  // Build a Bloom filter of bits bits, setting hashes bits per
+  // element. With threads > 1, the filter is filled by that many
+  // threads. Requires Enumerable/bloom.hpp.
+  template<typename Hash = std::hash<typename std::remove_const<T>::type>>
+  Bloom<typename std::remove_const<T>::type, Hash> to_bloom(size_t bits, unsigned hashes, unsigned threads = 1) {
     auto& self = *static_cast<Derived*>(this);
-    return Select<Derived, Not<Block>>(self, Not<Block>(b));
+    Bloom<typename std::remove_const<T>::type, Hash> res(bits, hashes);
+    res.insert_all(self, threads);
+    return res;
   }
 };
 
@@ -198,10 +713,37 @@ class Range : public Base<Range<T>, T> {
   T m_step;
 public:
   typedef T value_type;
-  Range(T start, T end, T step = 1) : m_current(start), m_end(end), m_step(step) { }
+  Range(T start, T end, T step = 1) : m_current(start), m_end(end), m_step(step) {
+    if(!(step > 0) && start < end)
+      throw std::invalid_argument("range: the step must be positive");
+  }
   operator bool() const { return m_current < m_end; }
   void operator++() { m_current += m_step; }
   T operator*() const { return m_current; }
+
+  // Splittable for integers only: with floating point numbers, the
+  // repeated additions of the serial iteration do not give the same
+  // values as start + n * step. The distance is computed in the
+  // unsigned type, as end - start may overflow T.
+  template<typename U = T, typename = typename std::enable_if<std::is_integral<U>::value>::type>
+  size_t size() const {
+    if(!(m_current < m_end)) return 0;
+    typedef typename std::make_unsigned<T>::type unsigned_type;
+    const size_t dist = (size_t)((unsigned_type)m_end - (unsigned_type)m_current);
+    const size_t step = (size_t)m_step;
+    return dist / step + (dist % step != 0);
+  }
+  static constexpr bool exact_size = std::is_integral<T>::value;
+  template<typename U = T, typename = typename std::enable_if<std::is_integral<U>::value>::type>
+  Range split(size_t n) {
+    typedef typename std::make_unsigned<T>::type unsigned_type;
+    const T mid = n < size() ? (T)((unsigned_type)m_current + (unsigned_type)n * (unsigned_type)m_step) : m_end;
+    Range res(m_current, mid, m_step);
+    m_current = mid;
+    return res;
+  }
+  template<typename U = T, typename = typename std::enable_if<std::is_integral<U>::value>::type>
+  void start() { }
 };
 
 // Map
@@ -217,6 +759,39 @@ public:
   operator bool() const { return m_enumerable; }
   void operator++() { ++m_enumerable; }
   value_type operator*() const { return m_block(*m_enumerable); }
+  const Enum& upstream() const { return m_enumerable; }
+
+  // Fusion: the following stages are composed with m_block and apply
+  // directly to m_enumerable
+  template<typename Block2>
+  auto map(Block2 b) {
+    auto f = [m = m_block, b](auto&& x) { return b(m(std::forward<decltype(x)>(x))); };
+    return Map<Enum, decltype(f)>(m_enumerable, f);
+  }
+  template<typename Block2>
+  auto select(Block2 b) {
+    typedef typename std::decay<value_type>::type out_type;
+    auto f = [m = m_block, b](auto&& x) {
+      std::optional<out_type> res(m(std::forward<decltype(x)>(x)));
+      if(!b(*res)) res.reset();
+      return res;
+    };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f);
+  }
+  template<typename Block2>
+  auto filter_map(Block2 b) {
+    auto f = [m = m_block, b](auto&& x) { return b(m(std::forward<decltype(x)>(x))); };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f);
+  }
+
+  // Splittable if Enum is
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  size_t size() const { return m_enumerable.size(); }
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  Map split(size_t n) { return Map(m_enumerable.split(n), m_block); }
+  static constexpr bool exact_size = has_exact_size<Enum>::value;
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  void start() { m_enumerable.start(); }
 };
 
 // Select
@@ -227,28 +802,246 @@ public:
 protected:
   Enum                                         m_enumerable;
   Block                                        m_block;
-  typename std::remove_const<value_type>::type m_value;
+  typename std::remove_const<value_type>::type m_value {};
   bool                                         m_has_value;
+  // Stop on the next selected element. m_enumerable is left on it,
+  // and advanced by the next increment only, so that an element
+  // referring to the state of m_enumerable (e.g. a string_view into
+  // its buffer) stays valid as long as the copy in m_value.
+  void find() {
+    m_has_value = false;
+    for( ; m_enumerable; ++m_enumerable) {
+      if((m_has_value = m_block(m_value = *m_enumerable)))
+        return;
+    }
+  }
 public:
-  Select(Enum e, Block b) : m_enumerable(e), m_block(b) { operator++(); }
+  Select(Enum e, Block b) : m_enumerable(e), m_block(b) { find(); }
   operator bool() const { return m_has_value; }
   void operator++() {
+    ++m_enumerable;
+    find();
+  }
+  const value_type& operator*() const { return m_value; }
+  const Enum& upstream() const { return m_enumerable; }
+
+  // Splittable if Enum is. The element already selected, if any, goes
+  // to the first chunk, which starts on it, and is not counted by
+  // size(). The chunks and the rest are not started: the predicate is
+  // evaluated by start(), on the thread processing the chunk.
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  size_t size() const { return m_enumerable.size() - m_has_value; }
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  Select split(size_t n) {
+    Select res(m_enumerable.split(n + m_has_value), m_block, *this);
     m_has_value = false;
-    for( ; m_enumerable && !m_has_value; ++m_enumerable) {
-      m_has_value = m_block(m_value = *m_enumerable);
+    return res;
+  }
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  void start() {
+    m_enumerable.start();
+    if(!m_has_value) find();
+  }
+
+  // Fusion into a FilterMap on m_enumerable. The element already
+  // selected goes through the new stage.
+  template<typename Block2>
+  auto map(Block2 b) {
+    typedef typename std::decay<decltype(b(m_value))>::type out_type;
+    auto f = [p = m_block, b](const value_type& x) { return p(x) ? std::optional<out_type>(b(x)) : std::nullopt; };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f, m_has_value ? std::optional<out_type>(b(m_value)) : std::nullopt, m_has_value);
+  }
+  template<typename Block2>
+  auto select(Block2 b) {
+    typedef typename std::remove_const<value_type>::type out_type;
+    auto f = [p = m_block, b](const value_type& x) { return p(x) && b(x) ? std::optional<out_type>(x) : std::nullopt; };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f, m_has_value && b(m_value) ? std::optional<out_type>(m_value) : std::nullopt, m_has_value);
+  }
+  template<typename Block2>
+  auto filter_map(Block2 b) {
+    typedef decltype(b(m_value)) opt_type;
+    auto f = [p = m_block, b](const value_type& x) { return p(x) ? b(x) : opt_type(); };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f, m_has_value ? b(m_value) : opt_type(), m_has_value);
+  }
+
+protected:
+  Select(Enum e, Block b, const Select& rhs)
+    : m_enumerable(e), m_block(b), m_value(rhs.m_value), m_has_value(rhs.m_has_value) { }
+};
+
+// FilterMap. Block returns a std::optional, and the elements are the
+// values of the engaged results. It is also the result of the fusion
+// of consecutive map, select and reject stages: they are composed in
+// one function, so there is a single loop and a single test per
+// element whatever the number of stages.
+template<typename Enum, typename Block>
+class FilterMap : public Base<FilterMap<Enum, Block>, typename std::invoke_result<Block, typename Enum::value_type>::type::value_type> {
+public:
+  typedef typename Enum::value_type                                   arg_type;
+  typedef typename std::invoke_result<Block, arg_type>::type          opt_type;
+  typedef typename opt_type::value_type                               value_type;
+  typedef Block                                                       block_type;
+protected:
+  Enum     m_enumerable;
+  Block    m_block;
+  opt_type m_value;
+
+  // Stop on the next engaged result, m_enumerable being left on its
+  // argument until the next increment, like Select
+  void find() {
+    m_value.reset();
+    for( ; m_enumerable; ++m_enumerable) {
+      if((m_value = m_block(*m_enumerable)))
+        return;
     }
   }
-  const value_type& operator*() const { return m_value; }
+  // Call f on the element held and on the others, to the end
+  template<typename F>
+  void drain(F f) {
+    if(m_value) {
+      f(*m_value);
+      ++m_enumerable;
+    }
+    for( ; m_enumerable; ++m_enumerable) {
+      auto r = m_block(*m_enumerable);
+      if(r) f(*r);
+    }
+    m_value.reset();
+  }
+
+public:
+  FilterMap(Enum e, Block b) : m_enumerable(e), m_block(b) { find(); }
+  // With the result held for the element e is on, if examined by the
+  // stages fused, or the empty optional
+  FilterMap(Enum e, Block b, opt_type held, bool examined) : m_enumerable(e), m_block(b), m_value(std::move(held)) {
+    if(m_value) return;
+    if(examined) ++m_enumerable;
+    find();
+  }
+  operator bool() const { return (bool)m_value; }
+  void operator++() {
+    ++m_enumerable;
+    find();
+  }
+  const value_type& operator*() const { return *m_value; }
+  const Enum& upstream() const { return m_enumerable; }
+
+  // each and inject run a single loop over m_enumerable, instead of
+  // the loop of find() inside the loop of the terminal, which the
+  // compiler does not merge
+  using Base<FilterMap, value_type>::each;
+  template<typename Block2>
+  void each(Block2 b) {
+    drain([&](const value_type& x) { this->call_block(b, x); });
+  }
+  using Base<FilterMap, value_type>::inject;
+  template<typename Block2, typename U>
+  typename std::decay<U>::type inject(U&& start, Block2 b) {
+    typedef typename std::decay<U>::type acc_type;
+    acc_type                             acc(std::forward<U>(start));
+    if constexpr(accepts_rvalue<Block2, acc_type, typename std::decay<value_type>::type>::value)
+      drain([&](const value_type& x) { acc = this->call_block(b, std::move(acc), x); });
+    else
+      drain([&](const value_type& x) { acc = this->call_block(b, acc, x); });
+    return acc;
+  }
+
+  // Fusion
+  template<typename Block2>
+  auto map(Block2 b) {
+    typedef std::optional<typename std::decay<decltype(b(*m_value))>::type> out_type;
+    auto f = [m = m_block, b](auto&& x) {
+      auto r = m(std::forward<decltype(x)>(x));
+      return r ? out_type(b(*r)) : out_type();
+    };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f, m_value ? out_type(b(*m_value)) : out_type(), (bool)m_value);
+  }
+  template<typename Block2>
+  auto select(Block2 b) {
+    auto f = [m = m_block, b](auto&& x) {
+      auto r = m(std::forward<decltype(x)>(x));
+      if(r && !b(*r)) r.reset();
+      return r;
+    };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f, m_value && b(*m_value) ? m_value : opt_type(), (bool)m_value);
+  }
+  template<typename Block2>
+  auto filter_map(Block2 b) {
+    typedef decltype(b(*m_value)) out_type;
+    auto f = [m = m_block, b](auto&& x) {
+      auto r = m(std::forward<decltype(x)>(x));
+      return r ? b(*r) : out_type();
+    };
+    return FilterMap<Enum, decltype(f)>(m_enumerable, f, m_value ? b(*m_value) : out_type(), (bool)m_value);
+  }
+
+  // Splittable if Enum is, like Select
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  size_t size() const { return m_enumerable.size() - (bool)m_value; }
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  FilterMap split(size_t n) {
+    FilterMap res(m_enumerable.split(n + (bool)m_value), m_block, split_tag());
+    res.m_value = std::move(m_value);
+    m_value.reset();
+    return res;
+  }
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  void start() {
+    m_enumerable.start();
+    if(!m_value) find();
+  }
+
+protected:
+  struct split_tag { };
+  FilterMap(Enum e, Block b, split_tag) : m_enumerable(e), m_block(b) { }
+};
+
+// SelectIn
+template<typename Enum, typename Set>
+class SelectIn : public Base<SelectIn<Enum, Set>, typename Enum::value_type> {
+public:
+  typedef typename Enum::value_type value_type;
+  static const size_t batch = 32;
+protected:
+  typedef typename std::remove_const<value_type>::type stored_type;
+  Enum                            m_enumerable;
+  const Set*                      m_set;
+  std::array<stored_type, batch>  m_values;
+  std::array<bool, batch>         m_hits;
+  size_t                          m_i, m_n;
+
+  // Read the next batch from m_enumerable and probe the set for all
+  // of them at once.
+  void fill() {
+    for(m_i = m_n = 0; m_enumerable && m_n < batch; ++m_enumerable, ++m_n)
+      m_values[m_n] = *m_enumerable;
+    m_set->contains(m_values.data(), m_n, m_hits.data());
+  }
+  void skip() {
+    while(true) {
+      for( ; m_i < m_n && !m_hits[m_i]; ++m_i) ;
+      if(m_i < m_n || !m_enumerable) break;
+      fill();
+    }
+  }
+public:
+  SelectIn(Enum e, const Set& s) : m_enumerable(e), m_set(&s), m_i(0), m_n(0) { skip(); }
+  operator bool() const { return m_i < m_n; }
+  void operator++() { ++m_i; skip(); }
+  const value_type& operator*() const { return m_values[m_i]; }
+  const Enum& upstream() const { return m_enumerable; }
 };
 
 // To standard iterator
 template<typename Enum>
-class Iterator : public std::iterator<std::input_iterator_tag, typename Enum::value_type> {
+class Iterator {
   Enum* m_enumerable;
-  typedef typename std::iterator<std::input_iterator_tag, typename Enum::value_type> super;
 public:
-  typedef typename super::value_type value_type;
-  typedef typename super::value_type pointer;
+  typedef std::input_iterator_tag     iterator_category;
+  typedef typename Enum::value_type   value_type;
+  typedef std::ptrdiff_t              difference_type;
+  typedef value_type                  pointer;
+  typedef value_type&                 reference;
 
   Iterator() : m_enumerable(nullptr) { }
   Iterator(Enum& e) : m_enumerable(new Enum(e)) { }
@@ -266,7 +1059,7 @@ public:
   template<typename Enum2>
   bool operator!=(const Iterator<Enum2>& rhs) { return !(*this == rhs); }
 
-  value_type operator*() const { return **m_enumerable; }
+  decltype(auto) operator*() const { return **m_enumerable; }
   pointer operator->() const { return &**m_enumerable; }
   Iterator& operator++() { ++*m_enumerable; return *this; }
 };
@@ -281,7 +1074,20 @@ public:
   StdIterator(Iterator first, Iterator last) : m_first(first), m_last(last) { }
   operator bool() const { return m_first != m_last; }
   void operator++() { ++m_first; }
-  value_type operator*() const { return *m_first; }
+  typename std::iterator_traits<Iterator>::reference operator*() const { return *m_first; }
+
+  // Splittable with random access iterators
+  template<typename I = Iterator, typename = typename std::enable_if<std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<I>::iterator_category>::value>::type>
+  size_t size() const { return m_last - m_first; }
+  static constexpr bool exact_size = true;
+  template<typename I = Iterator, typename = typename std::enable_if<std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<I>::iterator_category>::value>::type>
+  StdIterator split(size_t n) {
+    const Iterator mid = m_first + std::min(n, size());
+    StdIterator res(m_first, mid);
+    m_first = mid;
+    return res;
+  }
+  void start() { }
 };
 
 class IstreamLines : public Base<IstreamLines, std::string> {
@@ -322,11 +1128,184 @@ public:
   value_type operator*() const { return *m_enums[m_i]; }
 };
 
+// Concatenation of a runtime number of enumerables, the elements of
+// the enumerable Outer. With open > 1, a background thread creates
+// (opens) the enumerables ahead of time, while the current one is
+// consumed, with at most open enumerables alive at once. Outer is
+// only used by this thread. With open <= 1, the next enumerable is
+// created when the current one is exhausted. Copies share the same
+// state, as the opener thread: advancing a copy (e.g. the copy made
+// by begin(), or a stage such as map()) advances the original.
+template<typename Outer>
+class CatAll : public Base<CatAll<Outer>, typename std::decay<decltype(*std::declval<Outer&>())>::type::value_type> {
+  typedef typename std::decay<decltype(*std::declval<Outer&>())>::type inner_type;
+
+  struct state {
+    Outer                     outer;
+    const size_t              open;
+    std::optional<inner_type> cur;
+    std::deque<inner_type>    ready;        // Opened ahead
+    bool                      done = false; // Outer exhausted or error
+    bool                      stop = false;
+    std::exception_ptr        error;
+    std::mutex                mtx;
+    std::condition_variable   cond;
+    std::thread               opener;
+
+    state(Outer&& o, size_t n) : outer(std::move(o)), open(std::max(n, (size_t)1)) { }
+    ~state() {
+      if(!opener.joinable()) return;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+      }
+      cond.notify_all();
+      opener.join();
+    }
+
+    // Opener thread. The current enumerable counts as open.
+    void run() {
+      try {
+        while(true) {
+          {
+            std::unique_lock<std::mutex> lock(mtx);
+            cond.wait(lock, [&]() { return stop || ready.size() + 1 < open; });
+            if(stop) return;
+          }
+          if(!outer) break;
+          inner_type e(*outer); // Open outside the lock
+          ++outer;
+          std::lock_guard<std::mutex> lock(mtx);
+          ready.push_back(std::move(e));
+          cond.notify_all();
+        }
+      } catch(...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(mtx);
+      done = true;
+      cond.notify_all();
+    }
+
+    // Close the current enumerable and move to the next one. Return
+    // false if there are none left.
+    bool next() {
+      cur.reset();
+      if(!opener.joinable()) {
+        if(!outer) return false;
+        cur.emplace(*outer);
+        ++outer;
+        return true;
+      }
+      std::unique_lock<std::mutex> lock(mtx);
+      cond.wait(lock, [&]() { return !ready.empty() || done; });
+      if(ready.empty()) {
+        if(error)
+          std::rethrow_exception(error);
+        return false;
+      }
+      cur.emplace(std::move(ready.front()));
+      ready.pop_front();
+      cond.notify_all();
+      return true;
+    }
+    // Skip the empty enumerables
+    void skip() {
+      while(!*cur)
+        if(!next()) return;
+    }
+  };
+  std::shared_ptr<state> m_state;
+
+public:
+  typedef typename inner_type::value_type value_type;
+  CatAll(Outer outer, size_t open)
+    : m_state(std::make_shared<state>(std::move(outer), open))
+  {
+    if(m_state->open > 1)
+      m_state->opener = std::thread(&state::run, m_state.get());
+    if(m_state->next())
+      m_state->skip();
+  }
+  operator bool() const { return m_state->cur.has_value(); }
+  void operator++() {
+    ++*m_state->cur;
+    m_state->skip();
+  }
+  decltype(auto) operator*() const { return **m_state->cur; }
+};
+
+// Move the elements out of a container owned by the enumerable. Each
+// element can be dereferenced only once.
+template<typename Container>
+class Drain : public Base<Drain<Container>, typename Container::value_type> {
+  std::shared_ptr<Container>         m_container;
+  typename Container::iterator       m_it;
+public:
+  typedef typename Container::value_type value_type;
+  Drain(Container&& c)
+    : m_container(std::make_shared<Container>(std::move(c)))
+    , m_it(m_container->begin())
+  { }
+  operator bool() const { return m_it != m_container->end(); }
+  void operator++() { ++m_it; }
+  value_type&& operator*() const { return std::move(*m_it); }
+};
+
+// Array of N references to T, as pointers. Indexing and iterating
+// give const T&, and it converts to std::array<T, N> when a copy is
+// needed.
+template<typename T, size_t N>
+class RefArray {
+  std::array<const T*, N> m_ptrs;
+public:
+  typedef T value_type;
+  class const_iterator {
+    const T* const* m_p;
+  public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef T                               value_type;
+    typedef std::ptrdiff_t                  difference_type;
+    typedef const T*                        pointer;
+    typedef const T&                        reference;
+    explicit const_iterator(const T* const* p) : m_p(p) { }
+    reference operator*() const { return **m_p; }
+    pointer operator->() const { return *m_p; }
+    reference operator[](difference_type i) const { return *m_p[i]; }
+    const_iterator& operator++() { ++m_p; return *this; }
+    const_iterator operator++(int) { auto res = *this; ++m_p; return res; }
+    const_iterator& operator--() { --m_p; return *this; }
+    const_iterator& operator+=(difference_type i) { m_p += i; return *this; }
+    const_iterator operator+(difference_type i) const { return const_iterator(m_p + i); }
+    difference_type operator-(const const_iterator& rhs) const { return m_p - rhs.m_p; }
+    bool operator==(const const_iterator& rhs) const { return m_p == rhs.m_p; }
+    bool operator!=(const const_iterator& rhs) const { return m_p != rhs.m_p; }
+    bool operator<(const const_iterator& rhs) const { return m_p < rhs.m_p; }
+  };
+
+  const T*& ptr(size_t i) { return m_ptrs[i]; }
+  const T& operator[](size_t i) const { return *m_ptrs[i]; }
+  static constexpr size_t size() { return N; }
+  const_iterator begin() const { return const_iterator(m_ptrs.data()); }
+  const_iterator end() const { return const_iterator(m_ptrs.data() + N); }
+  operator std::array<T, N>() const {
+    std::array<T, N> res;
+    for(size_t i = 0; i < N; ++i)
+      res[i] = *m_ptrs[i];
+    return res;
+  }
+};
+
 template<typename... Enums>
 class Zipa : public Base<Zipa<Enums...>, typename std::common_type<Enums...>::type> {
   typedef typename std::common_type<Enums...>::type enum_type;
   typedef typename enum_type::value_type            common_value_type;
   static const size_t N = sizeof...(Enums);
+  // Reference to the elements if the enumerables return references
+  // (no copy). Otherwise, they are copied into an array.
+  static constexpr bool by_ref = std::is_lvalue_reference<decltype(*std::declval<const enum_type&>())>::value;
+  typedef RefArray<common_value_type, N> ref_type;
 public:
   typedef std::array<common_value_type, N> value_type;
   Zipa(Enums... es) : m_enums({{es...}}) { }
@@ -339,15 +1318,22 @@ public:
     for(size_t i = 0; i < N; ++i)
       ++m_enums[i];
   }
-  const value_type& operator*() const {
-    for(size_t i = 0; i < N; ++i)
-      m_values[i] = *(m_enums[i]);
-    return m_values;
+  typename std::conditional<by_ref, ref_type, const value_type&>::type operator*() const {
+    if constexpr(by_ref) {
+      ref_type res;
+      for(size_t i = 0; i < N; ++i)
+        res.ptr(i) = &*m_enums[i];
+      return res;
+    } else {
+      for(size_t i = 0; i < N; ++i)
+        m_values[i] = *(m_enums[i]);
+      return m_values;
+    }
   }
 
 protected:
-  std::array<enum_type, N>          m_enums;
-  mutable value_type                m_values;
+  std::array<enum_type, N>                                              m_enums;
+  mutable typename std::conditional<by_ref, std::tuple<>, value_type>::type m_values; // Unused if by_ref
 };
 
 // Helper functors for Zip
@@ -370,15 +1356,18 @@ template<typename T> struct inc<T, 0> {
   static void call(const T& e) { }
 };
 
-// Create a tuple from the results of calling operator* on the elements of tuple T
+// Create a tuple from the results of calling operator* on the
+// elements of tuple T. References are kept as references, only the
+// elements returned by value are stored in the tuple.
 template<typename T, size_t N = std::tuple_size<T>::value, size_t... S>
 struct star : public star<T, N-1, N-1, S...>
 { };
 
 template<typename T, size_t... S>
 struct star<T, 0, S...> {
-  static auto call(const T& e) {
-    return std::make_tuple(*std::get<S>(e)...);
+  typedef std::tuple<decltype(*std::get<S>(std::declval<const T&>()))...> type;
+  static type call(const T& e) {
+    return type(*std::get<S>(e)...);
   }
 };
 
@@ -390,13 +1379,215 @@ public:
   Zip(Enums... es) : m_enums(es...) { }
   operator bool() const { return more<enum_type>::call(m_enums); }
   void operator++() { inc<enum_type>::call(m_enums); }
-  value_type operator*() const { return star<enum_type>::call(m_enums); }
+  // Tuple of references to the elements of the enumerables (when
+  // they return references). Convertible to value_type.
+  typename star<enum_type>::type operator*() const { return star<enum_type>::call(m_enums); }
+
+  // Splittable if all the enumerables are, with an exact size:
+  // otherwise the chunks of the enumerables split at the same index
+  // would not be aligned (e.g. a Select counting its input).
+  template<bool B = (has_exact_size<Enums>::value && ...), typename = typename std::enable_if<B>::type>
+  size_t size() const {
+    return std::apply([](const Enums&... es) { return std::min({ es.size()... }); }, m_enums);
+  }
+  static constexpr bool exact_size = (has_exact_size<Enums>::value && ...);
+  template<bool B = (has_exact_size<Enums>::value && ...), typename = typename std::enable_if<B>::type>
+  Zip split(size_t n) {
+    return std::apply([n](Enums&... es) { return Zip(es.split(n)...); }, m_enums);
+  }
+  template<bool B = (has_exact_size<Enums>::value && ...), typename = typename std::enable_if<B>::type>
+  void start() {
+    std::apply([](Enums&... es) { (es.start(), ...); }, m_enums);
+  }
 
  protected:
   enum_type          m_enums;
 };
+
+// Type erased enumerable of T. Enumerables small enough are stored in
+// place (no heap allocation), and elements are pulled from the erased
+// enumerable by batches to amortize the cost of the virtual calls.
+template<typename T>
+class AnyEnumerable : public Base<AnyEnumerable<T>, T> {
+public:
+  typedef T value_type;
+protected:
+  typedef typename std::remove_const<T>::type stored_type;
+  static const size_t small_size = 64;
+  static const size_t batch      = sizeof(stored_type) >= 64 ? 4 : 256 / sizeof(stored_type);
+
+  struct concept_t {
+    virtual ~concept_t() { }
+    // Copy up to n elements into buf, return the number copied
+    virtual size_t fill(stored_type* buf, size_t n) = 0;
+    virtual concept_t* clone(void* storage) const = 0;
+    virtual concept_t* move(void* storage) = 0;
+  };
+
+  template<typename Enum>
+  struct model : public concept_t {
+    Enum m_enumerable;
+    static const bool small = sizeof(Enum) + sizeof(void*) <= small_size && alignof(Enum) <= alignof(std::max_align_t) &&
+      std::is_nothrow_move_constructible<Enum>::value;
+
+    typedef std::integral_constant<bool, small> small_type;
+
+    explicit model(const Enum& e) : m_enumerable(e) { }
+    explicit model(Enum&& e) : m_enumerable(std::move(e)) { }
+    template<typename E>
+    static concept_t* create(void* storage, E&& e, std::true_type) { return new(storage) model(std::forward<E>(e)); }
+    template<typename E>
+    static concept_t* create(void*, E&& e, std::false_type) { return new model(std::forward<E>(e)); }
+    size_t fill(stored_type* buf, size_t n) {
+      size_t i = 0;
+      for( ; i < n && m_enumerable; ++i, ++m_enumerable)
+        buf[i] = *m_enumerable;
+      return i;
+    }
+    concept_t* clone(void* storage) const { return create(storage, m_enumerable, small_type()); }
+    concept_t* move(void* storage) { return create(storage, std::move(m_enumerable), small_type()); }
+  };
+
+  typename std::aligned_storage<small_size, alignof(std::max_align_t)>::type m_storage;
+  concept_t*                                                                 m_impl;
+  std::array<stored_type, batch>                                             m_values;
+  size_t                                                                     m_i, m_n;
+
+  bool is_small() const { return m_impl == reinterpret_cast<const concept_t*>(&m_storage); }
+  void reset() {
+    if(is_small())
+      m_impl->~concept_t();
+    else
+      delete m_impl;
+    m_impl = nullptr;
+  }
+  void take(AnyEnumerable&& rhs) {
+    if(!rhs.m_impl)
+      m_impl = nullptr;
+    else if(rhs.is_small())
+      m_impl = rhs.m_impl->move(&m_storage);
+    else
+      std::swap(m_impl, rhs.m_impl);
+    std::move(rhs.m_values.begin() + rhs.m_i, rhs.m_values.begin() + rhs.m_n, m_values.begin());
+    m_i = 0;
+    m_n = rhs.m_n - rhs.m_i;
+  }
+  void copy(const AnyEnumerable& rhs) {
+    m_impl = rhs.m_impl ? rhs.m_impl->clone(&m_storage) : nullptr;
+    std::copy(rhs.m_values.begin() + rhs.m_i, rhs.m_values.begin() + rhs.m_n, m_values.begin());
+    m_i = 0;
+    m_n = rhs.m_n - rhs.m_i;
+  }
+
+public:
+  AnyEnumerable() : m_impl(nullptr), m_i(0), m_n(0) { }
+  template<typename Enum, typename = typename std::enable_if<!std::is_same<typename std::decay<Enum>::type, AnyEnumerable>::value>::type>
+  AnyEnumerable(Enum&& e) : m_i(0), m_n(0) {
+    typedef model<typename std::decay<Enum>::type> model_type;
+    m_impl = model_type::create(&m_storage, std::forward<Enum>(e), typename model_type::small_type());
+    m_n = m_impl->fill(m_values.data(), batch);
+  }
+  AnyEnumerable(const AnyEnumerable& rhs) : m_impl(nullptr) { copy(rhs); }
+  AnyEnumerable(AnyEnumerable&& rhs) : m_impl(nullptr) { take(std::move(rhs)); }
+  ~AnyEnumerable() { reset(); }
+  AnyEnumerable& operator=(const AnyEnumerable& rhs) {
+    if(this != &rhs) {
+      reset();
+      copy(rhs);
+    }
+    return *this;
+  }
+  AnyEnumerable& operator=(AnyEnumerable&& rhs) {
+    if(this != &rhs) {
+      reset();
+      take(std::move(rhs));
+    }
+    return *this;
+  }
+
+  operator bool() const { return m_i < m_n; }
+  void operator++() {
+    if(++m_i == m_n && m_impl) {
+      m_i = 0;
+      m_n = m_impl->fill(m_values.data(), batch);
+    }
+  }
+  const value_type& operator*() const { return m_values[m_i]; }
+};
+
+// Reducers of fanout(). bind<X>() returns the accumulator for
+// elements of type X, called on every element, then result().
+
+// Type of a copy of an element kept past the next increment
+template<typename X> struct owned { typedef X type; };
+template<typename C, typename Tr> struct owned<std::basic_string_view<C, Tr>> { typedef std::basic_string<C, Tr> type; };
+
+struct CountReducer {
+  size_t m_count = 0;
+  template<typename X> CountReducer bind() const { return *this; }
+  template<typename X> void operator()(const X&) { ++m_count; }
+  size_t result() const { return m_count; }
+};
+
+template<bool Max>
+struct ExtremumReducer {
+  // A string view is invalid after the next increment: the string is
+  // copied.
+  template<typename X>
+  struct acc {
+    typedef typename owned<X>::type res_type;
+    res_type m_res {};
+    bool     m_has = false;
+    void operator()(const X& x) {
+      if(!m_has || (Max ? m_res < x : x < m_res))
+        m_res = x;
+      m_has = true;
+    }
+    res_type result() { return std::move(m_res); }
+  };
+  template<typename X> acc<X> bind() const { return acc<X>(); }
+};
+
+template<typename U>
+struct SumReducer {
+  template<typename X>
+  struct acc {
+    typedef typename std::conditional<std::is_void<U>::value, X, U>::type sum_type;
+    sum_type m_res = sum_type(0);
+    void operator()(const X& x) { m_res += x; }
+    sum_type result() const { return m_res; }
+  };
+  template<typename X> acc<X> bind() const { return acc<X>(); }
+};
+
+template<typename U, typename Block>
+struct InjectReducer {
+  U     m_acc;
+  Block m_block;
+  template<typename X> InjectReducer bind() const { return *this; }
+  template<typename X> void operator()(const X& x) { m_acc = m_block(std::move(m_acc), x); }
+  U result() { return std::move(m_acc); }
+};
+
+template<typename Container>
+struct CollectReducer {
+  Container* m_container;
+  template<typename X> CollectReducer bind() const { return *this; }
+  template<typename X> void operator()(const X& x) { m_container->push_back(x); }
+  Container& result() const { return *m_container; }
+};
+
+template<typename Set>
+struct InsertReducer {
+  Set* m_set;
+  template<typename X> InsertReducer bind() const { return *this; }
+  template<typename X> void operator()(const X& x) { m_set->insert(x); }
+  Set& result() const { return *m_set; }
+};
 } // namespace imp
 
+using imp::AnyEnumerable;
+
 // Functions available directly in Enumerable namespace
 template<typename T = int>
 imp::Range<T> range(T start = 0, T end = std::numeric_limits<T>::max(), T step = 1) { return imp::Range<T>(start, end, step); }
@@ -427,12 +1618,49 @@ imp::Cat<Enums...> cat(Enums... es) {
   return imp::Cat<Enums...>(es...);
 }
 
+// Concatenate the enumerables in the vector
+template<typename Enum>
+imp::CatAll<imp::Drain<std::vector<Enum>>> cat(std::vector<Enum> es, size_t open = 2) {
+  return imp::CatAll<imp::Drain<std::vector<Enum>>>(imp::Drain<std::vector<Enum>>(std::move(es)), open);
+}
+
+// Concatenate the enumerables returned by the enumerable es. Creating
+// the enumerables lazily (e.g., with map over file names) bounds the
+// number of open enumerables to open.
+template<typename Enum>
+imp::CatAll<Enum> cat_all(Enum es, size_t open = 2) {
+  return imp::CatAll<Enum>(std::move(es), open);
+}
+
 template<typename... Enums>
 imp::Zipa<Enums...> zipa(Enums... es) { return imp::Zipa<Enums...>(es...); }
 
 template<typename... Enums>
 imp::Zip<Enums...> zip(Enums... es) { return imp::Zip<Enums...>(es...); }
 
+// Reducers for fanout()
+namespace reducer {
+// Number of elements
+inline imp::CountReducer count() { return imp::CountReducer(); }
+// Largest and smallest element (a default value if empty). A copy is
+// kept, as a std::string for string views.
+inline imp::ExtremumReducer<true> max() { return imp::ExtremumReducer<true>(); }
+inline imp::ExtremumReducer<false> min() { return imp::ExtremumReducer<false>(); }
+// Sum in order, of type U (by default the type of the elements)
+template<typename U = void>
+imp::SumReducer<U> sum() { return imp::SumReducer<U>(); }
+// acc = b(acc, x) for every element, starting from init
+template<typename U, typename Block>
+imp::InjectReducer<U, Block> inject(U init, Block b) { return imp::InjectReducer<U, Block>{ std::move(init), b }; }
+// Append the elements to c. Returns a reference to c.
+template<typename Container>
+imp::CollectReducer<Container> collect(Container& c) { return imp::CollectReducer<Container>{ &c }; }
+// Insert the elements in the set s (e.g., a std::set or a sketch such
+// as a Bloom filter). Returns a reference to s.
+template<typename Set>
+imp::InsertReducer<Set> insert(Set& s) { return imp::InsertReducer<Set>{ &s }; }
+} // namespace reducer
+
 namespace imp {
 // Numeric operator become maps
 template<typename Derived, typename T, typename U>
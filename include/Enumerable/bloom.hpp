@@ -0,0 +1,274 @@
+#ifndef __ENUMERABLE_BLOOM_H__
+#define __ENUMERABLE_BLOOM_H__
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <Enumerable.hpp>
+#include <Enumerable/parallel.hpp>
+
+namespace Enumerable {
+namespace imp {
+
+// Finalizer of MurmurHash3. std::hash is the identity on integers, so
+// the hash values are mixed before being used.
+inline uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+#if defined(__x86_64__)
+// Compare 4 words at a time, gathered from the filter.
+__attribute__((target("avx2")))
+inline void bloom_probe_avx2(const uint64_t* words, const uint64_t* idx, const uint64_t* masks, size_t n, bool* res) {
+  size_t i = 0;
+  for( ; i + 4 <= n; i += 4) {
+    const __m256i vi = _mm256_loadu_si256((const __m256i*)(idx + i));
+    const __m256i vm = _mm256_loadu_si256((const __m256i*)(masks + i));
+    const __m256i vw = _mm256_i64gather_epi64((const long long*)words, vi, 8);
+    const __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(vw, vm), vm);
+    const int     r  = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    for(int j = 0; j < 4; ++j)
+      res[i + j] = (r >> j) & 1;
+  }
+  for( ; i < n; ++i)
+    res[i] = (words[idx[i]] & masks[i]) == masks[i];
+}
+
+inline bool bloom_have_avx2() {
+  static const bool have = __builtin_cpu_supports("avx2");
+  return have;
+}
+#endif
+
+// Register-blocked Bloom filter: all the bits of an element are set
+// in one 64 bits word, so a query costs one memory access and one
+// comparison. The filter can be saved to a file and memory mapped
+// back with Bloom::map.
+template<typename T, typename Hash = std::hash<T>>
+class Bloom {
+  struct header {
+    char     magic[8];
+    uint64_t nwords;
+    uint32_t k;
+    uint32_t pad;
+  };
+  static constexpr size_t   header_size = 64; // Keep the words aligned on a cache line
+  static constexpr unsigned max_k       = 10; // 6 bits per position from a 64 bits hash
+  static constexpr size_t   batch       = 64;
+
+  uint64_t* m_words;
+  size_t    m_nwords;
+  unsigned  m_k;
+  void*     m_map;              // Memory mapped region containing m_words
+  size_t    m_map_len;
+  Hash      m_hash;
+
+  Bloom(void* map, size_t map_len, uint64_t* words, size_t nwords, unsigned k)
+    : m_words(words), m_nwords(nwords), m_k(k), m_map(map), m_map_len(map_len) { }
+
+  void position(const T& x, uint64_t& idx, uint64_t& mask) const {
+    const uint64_t h = mix64(m_hash(x));
+    idx              = (uint64_t)(((unsigned __int128)h * m_nwords) >> 64);
+    uint64_t       g = (h ^ (h >> 31)) * 0xbf58476d1ce4e5b9ULL;
+    mask             = 0;
+    for(unsigned i = 0; i < m_k; ++i, g >>= 6)
+      mask |= (uint64_t)1 << (g & 63);
+  }
+
+  void release() {
+    if(m_map)
+      munmap(m_map, m_map_len);
+    m_map = nullptr;
+  }
+
+public:
+  typedef T value_type;
+
+  Bloom(size_t bits, unsigned k, Hash h = Hash())
+    : m_nwords(std::max((size_t)1, (bits + 63) / 64))
+    , m_k(k)
+    , m_map_len(m_nwords * sizeof(uint64_t))
+    , m_hash(h)
+  {
+    if(k == 0 || k > max_k)
+      throw std::invalid_argument("Bloom: number of hashes must be between 1 and 10");
+    // Anonymous mapping: zeroed and allocated lazily by the kernel
+    m_map = mmap(nullptr, m_map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m_map == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), "Bloom: allocation failed");
+    m_words = static_cast<uint64_t*>(m_map);
+  }
+  Bloom(const Bloom&) = delete;
+  Bloom(Bloom&& rhs)
+    : m_words(rhs.m_words), m_nwords(rhs.m_nwords), m_k(rhs.m_k)
+    , m_map(rhs.m_map), m_map_len(rhs.m_map_len), m_hash(rhs.m_hash)
+  { rhs.m_map = nullptr; }
+  ~Bloom() { release(); }
+  Bloom& operator=(const Bloom&) = delete;
+  Bloom& operator=(Bloom&& rhs) {
+    release();
+    m_words   = rhs.m_words;
+    m_nwords  = rhs.m_nwords;
+    m_k       = rhs.m_k;
+    m_map     = rhs.m_map;
+    m_map_len = rhs.m_map_len;
+    m_hash    = rhs.m_hash;
+    rhs.m_map = nullptr;
+    return *this;
+  }
+
+  size_t   bits() const { return m_nwords * 64; }
+  unsigned hashes() const { return m_k; }
+
+  void insert(const T& x) {
+    uint64_t idx, mask;
+    position(x, idx, mask);
+    m_words[idx] |= mask;
+  }
+
+  // Safe to call concurrently from many threads
+  void insert_atomic(const T& x) {
+    uint64_t idx, mask;
+    position(x, idx, mask);
+    if((__atomic_load_n(m_words + idx, __ATOMIC_RELAXED) & mask) != mask)
+      __atomic_fetch_or(m_words + idx, mask, __ATOMIC_RELAXED);
+  }
+
+  bool contains(const T& x) const {
+    uint64_t idx, mask;
+    position(x, idx, mask);
+    return (m_words[idx] & mask) == mask;
+  }
+
+  // Query n elements at once. The words are prefetched before being
+  // compared, and compared with AVX2 when available.
+  void contains(const T* xs, size_t n, bool* res) const {
+    uint64_t idx[batch], masks[batch];
+    for(size_t i = 0; i < n; i += batch) {
+      const size_t m = n - i < batch ? n - i : batch;
+      for(size_t j = 0; j < m; ++j) {
+        position(xs[i + j], idx[j], masks[j]);
+        __builtin_prefetch(m_words + idx[j]);
+      }
+#if defined(__x86_64__)
+      if(bloom_have_avx2()) {
+        bloom_probe_avx2(m_words, idx, masks, m, res + i);
+        continue;
+      }
+#endif
+      for(size_t j = 0; j < m; ++j)
+        res[i + j] = (m_words[idx[j]] & masks[j]) == masks[j];
+    }
+  }
+
+  // Union with a filter of the same geometry (e.g. built by another job)
+  Bloom& merge(const Bloom& rhs) {
+    if(m_nwords != rhs.m_nwords || m_k != rhs.m_k)
+      throw std::invalid_argument("Bloom: merging filters of different geometry");
+    for(size_t i = 0; i < m_nwords; ++i)
+      m_words[i] |= rhs.m_words[i];
+    return *this;
+  }
+
+  // Insert all the elements of the enumerable e. With threads > 1,
+  // the calling thread reads the elements by batches, and the batches
+  // are inserted in parallel by the thread pool.
+  template<typename Enum>
+  void insert_all(Enum& e, unsigned threads) {
+    if(threads <= 1) {
+      for( ; e; ++e)
+        insert(*e);
+      return;
+    }
+
+    std::vector<std::vector<T>> batches(4 * threads);
+    while(e) {
+      size_t nb = 0;
+      for( ; e && nb < batches.size(); ++nb) {
+        auto& values = batches[nb];
+        values.clear();
+        for( ; e && values.size() < 1024; ++e)
+          values.push_back(*e);
+      }
+      parallel_for(nb, threads, [&](size_t i) {
+          for(const auto& x : batches[i])
+            insert_atomic(x);
+        });
+    }
+  }
+
+  void save(const std::string& path) const {
+    std::ofstream os(path, std::ios::binary);
+    char buf[header_size];
+    memset(buf, 0, sizeof(buf));
+    header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "EnumBlm1", sizeof(h.magic));
+    h.nwords = m_nwords;
+    h.k      = m_k;
+    memcpy(buf, &h, sizeof(h));
+    os.write(buf, sizeof(buf));
+    os.write(reinterpret_cast<const char*>(m_words), m_nwords * sizeof(uint64_t));
+    if(!os.good())
+      throw std::runtime_error("Bloom: failed to write '" + path + "'");
+  }
+
+  // Memory map a filter saved by save(). The mapping is private:
+  // inserting in the filter does not modify the file.
+  static Bloom map(const std::string& path, Hash hash = Hash()) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1)
+      throw std::system_error(errno, std::generic_category(), "Bloom: can't open '" + path + "'");
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+      const int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), "Bloom: can't stat '" + path + "'");
+    }
+    void* map = (size_t)st.st_size >= header_size
+      ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+      : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED)
+      throw std::runtime_error("Bloom: can't map '" + path + "'");
+
+    header h;
+    memcpy(&h, map, sizeof(h));
+    if(memcmp(h.magic, "EnumBlm1", sizeof(h.magic)) || h.k == 0 || h.k > max_k ||
+       header_size + h.nwords * sizeof(uint64_t) != (size_t)st.st_size) {
+      munmap(map, st.st_size);
+      throw std::runtime_error("Bloom: invalid filter file '" + path + "'");
+    }
+    Bloom res(map, st.st_size, reinterpret_cast<uint64_t*>(static_cast<char*>(map) + header_size), h.nwords, h.k);
+    res.m_hash = hash;
+    return res;
+  }
+};
+
+} // namespace imp
+
+using imp::Bloom;
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_BLOOM_H__ */
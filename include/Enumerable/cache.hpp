@@ -0,0 +1,269 @@
+#ifndef __ENUMERABLE_CACHE_H__
+#define __ENUMERABLE_CACHE_H__
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <Enumerable.hpp>
+
+// Materialization of an enumerable, e.g. to traverse lines(is)
+// several times:
+//
+//   auto c = lines(is).select(f).cache();
+//   auto n = c.replay().count();
+//   auto m = c.replay().max();
+//
+// The elements are pulled from the source on the first traversal and
+// stored in an arena of large chunks. The other traversals read them
+// from memory. Strings are stored contiguously and enumerated as
+// std::string_view. Beyond the memory budget, the chunks are mapped
+// from a temporary file, so that the kernel writes them back to disk
+// instead of swapping.
+
+namespace Enumerable {
+
+struct cache_options {
+  size_t      chunk_size = 1 << 20;         // Bytes per chunk of the arena
+  size_t      memory     = (size_t)1 << 30; // Bytes of chunks allocated in memory, 0 for no limit
+  std::string spill_dir;                    // Directory of the temporary file. $TMPDIR or /tmp if empty.
+};
+
+namespace imp {
+
+inline size_t cache_align(size_t x, size_t a) { return (x + a - 1) / a * a; }
+
+// Chunks of memory, never moved, filled one after the other.
+class CacheArena {
+  struct chunk {
+    char*  data;
+    size_t size;
+    size_t used;
+    bool   mapped; // From the temporary file
+  };
+
+  cache_options      m_options;
+  std::vector<chunk> m_chunks;
+  size_t             m_in_memory = 0;
+  int                m_fd        = -1;
+  size_t             m_file_size = 0;
+
+  char* map_chunk(size_t size) {
+    if(m_fd == -1) {
+      std::string dir = m_options.spill_dir;
+      if(dir.empty()) {
+        const char* tmp = getenv("TMPDIR");
+        dir = tmp && *tmp ? tmp : "/tmp";
+      }
+      std::string path = dir + "/enumerable_cache.XXXXXX";
+      m_fd = mkstemp(&path[0]);
+      if(m_fd == -1)
+        throw std::system_error(errno, std::generic_category(), "cache: can't create a file in '" + dir + "'");
+      unlink(path.c_str()); // Removed when closed
+    }
+    if(ftruncate(m_fd, m_file_size + size) == -1)
+      throw std::system_error(errno, std::generic_category(), "cache: can't extend the temporary file");
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, m_file_size);
+    if(data == MAP_FAILED)
+      throw std::system_error(errno, std::generic_category(), "cache: can't map the temporary file");
+    m_file_size += size;
+    return (char*)data;
+  }
+
+public:
+  explicit CacheArena(const cache_options& opts) : m_options(opts) {
+    m_options.chunk_size = cache_align(std::max(m_options.chunk_size, (size_t)4096), 4096);
+  }
+  CacheArena(const CacheArena&) = delete;
+  CacheArena& operator=(const CacheArena&) = delete;
+  ~CacheArena() {
+    for(auto& c : m_chunks) {
+      if(c.mapped)
+        munmap(c.data, c.size);
+      else
+        delete [] c.data;
+    }
+    if(m_fd != -1) close(m_fd);
+  }
+
+  // Room for size bytes aligned on align in the last chunk, or in a
+  // new one (larger than chunk_size if needed).
+  char* allocate(size_t size, size_t align) {
+    if(!m_chunks.empty()) {
+      chunk&       c     = m_chunks.back();
+      const size_t start = cache_align(c.used, align);
+      if(start + size <= c.size) {
+        c.used = start + size;
+        return c.data + start;
+      }
+    }
+    const size_t csize  = std::max(m_options.chunk_size, cache_align(size, 4096));
+    const bool   mapped = m_options.memory && m_in_memory + csize > m_options.memory;
+    char*        data   = mapped ? map_chunk(csize) : new char[csize];
+    if(!mapped) m_in_memory += csize;
+    m_chunks.push_back(chunk{ data, csize, size, mapped });
+    return data;
+  }
+
+  size_t      chunks() const { return m_chunks.size(); }
+  const char* data(size_t i) const { return m_chunks[i].data; }
+  size_t      used(size_t i) const { return m_chunks[i].used; }
+  size_t      in_memory() const { return m_in_memory; }
+  size_t      spilled() const { return m_file_size; }
+};
+
+// Position of an element in the store
+struct CachePos {
+  size_t chunk  = 0;
+  size_t offset = 0;
+};
+
+// Elements trivially copyable: copied in the arena
+template<typename T, typename = void>
+class CacheStore {
+  CacheArena m_arena;
+public:
+  typedef const T  value_type;
+  typedef const T& reference;
+  explicit CacheStore(const cache_options& opts) : m_arena(opts) { }
+  void append(const T& x) { memcpy(m_arena.allocate(sizeof(T), alignof(T)), &x, sizeof(T)); }
+  reference get(CachePos& p) const {
+    if(p.offset >= m_arena.used(p.chunk)) {
+      ++p.chunk;
+      p.offset = 0;
+    }
+    return *reinterpret_cast<const T*>(m_arena.data(p.chunk) + p.offset);
+  }
+  void next(CachePos& p) const {
+    get(p);
+    p.offset += sizeof(T);
+  }
+  const CacheArena& arena() const { return m_arena; }
+};
+
+// Strings: the length followed by the characters
+template<typename T>
+class CacheStore<T, typename std::enable_if<std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value>::type> {
+  CacheArena m_arena;
+public:
+  typedef std::string_view value_type;
+  typedef std::string_view reference;
+  explicit CacheStore(const cache_options& opts) : m_arena(opts) { }
+  void append(std::string_view x) {
+    const uint64_t len = x.size();
+    char*          p   = m_arena.allocate(sizeof(len) + len, alignof(uint64_t));
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), x.data(), len);
+  }
+  // The next record starts on an 8 bytes boundary, in this chunk if
+  // before its end
+  reference get(CachePos& p) const {
+    p.offset = cache_align(p.offset, alignof(uint64_t));
+    if(p.offset >= m_arena.used(p.chunk)) {
+      ++p.chunk;
+      p.offset = 0;
+    }
+    const char* data = m_arena.data(p.chunk) + p.offset;
+    uint64_t    len;
+    memcpy(&len, data, sizeof(len));
+    return std::string_view(data + sizeof(len), len);
+  }
+  void next(CachePos& p) const {
+    const size_t len = get(p).size();
+    p.offset += sizeof(uint64_t) + len;
+  }
+  const CacheArena& arena() const { return m_arena; }
+};
+
+// Other types: copied in a deque, in memory
+template<typename T>
+class CacheStore<T, typename std::enable_if<!std::is_trivially_copyable<T>::value && !std::is_same<T, std::string>::value &&
+                                            !std::is_same<T, std::string_view>::value>::type> {
+  std::deque<T> m_elements;
+  CacheArena    m_arena; // Empty
+public:
+  typedef const T  value_type;
+  typedef const T& reference;
+  explicit CacheStore(const cache_options& opts) : m_arena(opts) { }
+  void append(const T& x) { m_elements.push_back(x); }
+  reference get(CachePos& p) const { return m_elements[p.offset]; }
+  void next(CachePos& p) const { ++p.offset; }
+  const CacheArena& arena() const { return m_arena; }
+};
+
+// Handle on the cached elements of Enum. The copies share the
+// elements, and each enumerates them from its own position. The
+// first handle to reach the end of the stored elements pulls the next
+// one from the source. Not thread safe.
+template<typename Enum>
+class Cache : public Base<Cache<Enum>, typename CacheStore<typename std::decay<typename Enum::value_type>::type>::value_type> {
+  typedef typename std::decay<typename Enum::value_type>::type stored_type;
+  typedef CacheStore<stored_type>                               store_type;
+
+  struct state {
+    Enum       source;
+    store_type store;
+    size_t     size = 0; // Elements stored
+    state(const Enum& e, const cache_options& opts) : source(e), store(opts) { }
+  };
+
+  std::shared_ptr<state> m_state;
+  CachePos               m_pos;
+  size_t                 m_index = 0;
+
+public:
+  typedef typename store_type::value_type value_type;
+
+  Cache(const Enum& e, const cache_options& opts) : m_state(std::make_shared<state>(e, opts)) { }
+
+  // Pull the element from the source if not stored yet. Must be
+  // called before operator* and operator++.
+  operator bool() const {
+    state& s = *m_state;
+    if(m_index < s.size) return true;
+    if(!s.source) return false;
+    s.store.append(*s.source);
+    ++s.source;
+    ++s.size;
+    return true;
+  }
+  void operator++() {
+    m_state->store.next(m_pos);
+    ++m_index;
+  }
+  typename store_type::reference operator*() const {
+    CachePos p = m_pos;
+    return m_state->store.get(p);
+  }
+
+  // New handle enumerating the elements from the start
+  Cache replay() const {
+    Cache res(*this);
+    res.m_pos   = CachePos();
+    res.m_index = 0;
+    return res;
+  }
+
+  // Number of elements stored so far, and bytes of the arena in memory
+  // and in the temporary file
+  size_t cached() const { return m_state->size; }
+  size_t memory() const { return m_state->store.arena().in_memory(); }
+  size_t spilled() const { return m_state->store.arena().spilled(); }
+};
+
+} // namespace imp
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_CACHE_H__ */
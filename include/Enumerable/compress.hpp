@@ -0,0 +1,372 @@
+#ifndef __ENUMERABLE_COMPRESS_H__
+#define __ENUMERABLE_COMPRESS_H__
+
+// Decompression of gzip (and zstd, if ENUMERABLE_HAVE_ZSTD is
+// defined) files. Programs using this header must be linked with -lz
+// (and -lzstd).
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef ENUMERABLE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <Enumerable/io.hpp>
+#include <Enumerable/parallel.hpp>
+
+namespace Enumerable {
+
+enum class compression { none, gzip, bgzf, zstd };
+
+namespace imp {
+
+// Chunk source decompressing a file on a background thread into a
+// ring of depth buffers, so decompression overlaps with the
+// consumer. The format is detected from the magic number, and files
+// not compressed are passed through. BGZF files (gzip made of
+// independent blocks of at most 64KB, as written by bgzip) are
+// decompressed by batches of blocks, the blocks of a batch in
+// parallel on threads threads.
+class Decompress {
+  struct slot {
+    std::vector<char> data;
+    size_t            filled = 0;
+    bool              ready  = false;
+  };
+
+  int                     m_fd;
+  compression             m_format;
+  size_t                  m_buffer_size;
+  unsigned                m_threads;
+  std::vector<slot>       m_slots;
+  size_t                  m_cur;        // Slot to return next
+  size_t                  m_put;        // Slot to fill next
+  bool                    m_returned;   // m_cur - 1 is held by the consumer
+  bool                    m_done;       // End of file returned
+  std::vector<char>       m_in;         // Compressed input
+  size_t                  m_in_pos, m_in_end;
+  bool                    m_eof;
+  std::thread             m_thread;
+  std::mutex              m_mutex;
+  std::condition_variable m_cond;
+  bool                    m_stop;
+  std::exception_ptr      m_error;
+
+  size_t prev(size_t i) const { return (i + m_slots.size() - 1) % m_slots.size(); }
+
+  // Input: read more data after the unread part of m_in
+  bool fill_input(size_t want = 0) {
+    if(m_in_pos > 0) {
+      memmove(m_in.data(), m_in.data() + m_in_pos, m_in_end - m_in_pos);
+      m_in_end -= m_in_pos;
+      m_in_pos  = 0;
+    }
+    if(m_in.size() < want)
+      m_in.resize(want);
+    while(!m_eof && m_in_end < std::max(want, (size_t)1)) {
+      const ssize_t r = ::read(m_fd, m_in.data() + m_in_end, m_in.size() - m_in_end);
+      if(r < 0) {
+        if(errno == EINTR) continue;
+        throw io_error("read");
+      }
+      m_eof     = r == 0;
+      m_in_end += r;
+    }
+    return m_in_end >= std::max(want, (size_t)1);
+  }
+  size_t available() const { return m_in_end - m_in_pos; }
+
+  // Producer side of the ring: wait for the next slot to be free, and
+  // hand it to the consumer. Returns nullptr when stopped.
+  slot* acquire() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto& s = m_slots[m_put];
+    if(!m_stop && s.ready) {
+      ENUMERABLE_TRACE_SCOPE("inflate push wait");
+      m_cond.wait(lock, [&]() { return m_stop || !s.ready; });
+    }
+    return m_stop ? nullptr : &s;
+  }
+  void publish(slot& s) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    s.ready = true;
+    m_put   = (m_put + 1) % m_slots.size();
+    m_cond.notify_all();
+  }
+
+  void run() {
+    try {
+      switch(m_format) {
+      case compression::none: copy(); break;
+      case compression::gzip: inflate_stream(); break;
+      case compression::bgzf: inflate_bgzf(); break;
+      case compression::zstd: zstd_stream(); break;
+      }
+    } catch(...) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_error = std::current_exception();
+    }
+    // An empty slot marks the end of the data
+    slot* s = acquire();
+    if(!s) return;
+    s->filled = 0;
+    publish(*s);
+  }
+
+  void copy() {
+    while(true) {
+      if(available() == 0 && !fill_input())
+        return;
+      slot* s = acquire();
+      if(!s) return;
+      s->data.resize(m_buffer_size);
+      s->filled = std::min(available(), m_buffer_size);
+      memcpy(s->data.data(), m_in.data() + m_in_pos, s->filled);
+      m_in_pos += s->filled;
+      publish(*s);
+    }
+  }
+
+  // Generic gzip or zlib stream, possibly made of many members
+  void inflate_stream() {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, 15 + 32) != Z_OK)
+      throw std::runtime_error("inflateInit failed");
+    struct end { z_stream& zs; ~end() { inflateEnd(&zs); } } e { zs };
+    bool in_member = false;
+    while(true) {
+      slot* s = acquire();
+      if(!s) return;
+      s->data.resize(m_buffer_size);
+      zs.next_out  = reinterpret_cast<Bytef*>(s->data.data());
+      zs.avail_out = m_buffer_size;
+      while(zs.avail_out > 0) {
+        if(available() == 0 && !fill_input())
+          break;
+        zs.next_in  = reinterpret_cast<Bytef*>(m_in.data() + m_in_pos);
+        zs.avail_in = available();
+        const int ret = inflate(&zs, Z_NO_FLUSH);
+        m_in_pos = m_in_end - zs.avail_in;
+        if(ret == Z_STREAM_END) {
+          inflateReset(&zs); // Concatenated members
+          in_member = false;
+        } else if(ret == Z_OK || ret == Z_BUF_ERROR) {
+          in_member = true;
+        } else {
+          throw std::runtime_error(std::string("gzip: ") + (zs.msg ? zs.msg : "invalid data"));
+        }
+      }
+      s->filled = m_buffer_size - zs.avail_out;
+      if(s->filled == 0) {
+        if(in_member)
+          throw std::runtime_error("gzip: truncated input");
+        return;
+      }
+      publish(*s);
+    }
+  }
+
+  // BGZF: every block is a gzip member with a 'BC' extra field
+  // giving its compressed size, and its uncompressed size in the
+  // trailer. A batch of blocks is read, the output offsets are
+  // computed from the trailers and the blocks are inflated in
+  // parallel into the same slot.
+  static const size_t bgzf_max_block = 1 << 16;
+  static size_t bgzf_block_size(const char* h) {
+    return ((uint8_t)h[16] | ((size_t)(uint8_t)h[17] << 8)) + 1;
+  }
+  static bool is_bgzf(const char* h, size_t n) {
+    return n >= 18 && (uint8_t)h[0] == 0x1f && (uint8_t)h[1] == 0x8b && h[2] == 8 && (h[3] & 4) &&
+      h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0;
+  }
+  static uint32_t le32(const char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+  }
+  static void inflate_block(const char* in, size_t in_size, char* out, size_t out_size) {
+    const size_t xlen = (uint8_t)in[10] | ((size_t)(uint8_t)in[11] << 8);
+    if(in_size < 12 + xlen + 8)
+      throw std::runtime_error("bgzf: invalid block");
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, -15) != Z_OK)
+      throw std::runtime_error("inflateInit failed");
+    zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(in + 12 + xlen));
+    zs.avail_in  = in_size - 12 - xlen - 8;
+    zs.next_out  = reinterpret_cast<Bytef*>(out);
+    zs.avail_out = out_size;
+    const int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if(ret != Z_STREAM_END || zs.avail_out != 0 ||
+       crc32(0, reinterpret_cast<const Bytef*>(out), out_size) != le32(in + in_size - 8))
+      throw std::runtime_error("bgzf: corrupted block");
+  }
+
+  void inflate_bgzf() {
+    const size_t batch = std::max((size_t)1, m_buffer_size / bgzf_max_block);
+    std::vector<size_t> starts, sizes, offsets;
+    while(true) {
+      // Read up to batch complete blocks in m_in
+      starts.clear(); sizes.clear(); offsets.clear();
+      fill_input(batch * bgzf_max_block);
+      size_t pos = m_in_pos, total = 0;
+      while(starts.size() < batch && m_in_end - pos >= 18) {
+        if(!is_bgzf(m_in.data() + pos, m_in_end - pos))
+          throw std::runtime_error("bgzf: invalid block header");
+        const size_t size = bgzf_block_size(m_in.data() + pos);
+        if(size < 26 || m_in_end - pos < size)
+          break;
+        starts.push_back(pos);
+        sizes.push_back(size);
+        offsets.push_back(total);
+        total += le32(m_in.data() + pos + size - 4);
+        pos   += size;
+      }
+      if(starts.empty()) {
+        if(available() > 0)
+          throw std::runtime_error("bgzf: truncated input");
+        return;
+      }
+      if(total == 0) { // Empty blocks, e.g. the end of file marker
+        m_in_pos = pos;
+        continue;
+      }
+
+      slot* s = acquire();
+      if(!s) return;
+      s->data.resize(std::max(total, s->data.size()));
+      offsets.push_back(total);
+      parallel_for(starts.size(), m_threads, [&](size_t j) {
+          inflate_block(m_in.data() + starts[j], sizes[j], s->data.data() + offsets[j], offsets[j + 1] - offsets[j]);
+        });
+      s->filled = total;
+      m_in_pos  = pos;
+      publish(*s);
+    }
+  }
+
+#ifdef ENUMERABLE_HAVE_ZSTD
+  void zstd_stream() {
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    if(!zs) throw std::bad_alloc();
+    struct end { ZSTD_DStream* zs; ~end() { ZSTD_freeDStream(zs); } } e { zs };
+    ZSTD_initDStream(zs);
+    size_t hint = 1; // Non zero while in the middle of a frame
+    while(true) {
+      slot* s = acquire();
+      if(!s) return;
+      s->data.resize(m_buffer_size);
+      ZSTD_outBuffer out = { s->data.data(), m_buffer_size, 0 };
+      while(out.pos < out.size) {
+        if(available() == 0 && !fill_input())
+          break;
+        ZSTD_inBuffer in = { m_in.data() + m_in_pos, available(), 0 };
+        hint = ZSTD_decompressStream(zs, &out, &in);
+        if(ZSTD_isError(hint))
+          throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(hint));
+        m_in_pos += in.pos;
+      }
+      s->filled = out.pos;
+      if(s->filled == 0) {
+        if(hint != 0)
+          throw std::runtime_error("zstd: truncated input");
+        return;
+      }
+      publish(*s);
+    }
+  }
+#else
+  void zstd_stream() {
+    throw std::runtime_error("zstd: support not compiled in");
+  }
+#endif
+
+public:
+  Decompress(const std::string& path, const read_options& opts = read_options(), unsigned threads = 1)
+    : m_buffer_size(opts.buffer_size), m_threads(std::max(1u, threads)), m_cur(0), m_put(0), m_returned(false), m_done(false)
+    , m_in(std::max((size_t)1 << 16, opts.buffer_size / 4)), m_in_pos(0), m_in_end(0), m_eof(false), m_stop(false)
+  {
+    m_fd = open(path.c_str(), O_RDONLY);
+    if(m_fd == -1)
+      throw io_error("Can't open '" + path + "'");
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    try {
+      fill_input(18);
+    } catch(...) {
+      close(m_fd);
+      throw;
+    }
+    const char* h = m_in.data();
+    if(m_in_end >= 2 && (uint8_t)h[0] == 0x1f && (uint8_t)h[1] == 0x8b)
+      m_format = is_bgzf(h, m_in_end) ? compression::bgzf : compression::gzip;
+    else if(m_in_end >= 4 && le32(h) == 0xfd2fb528)
+      m_format = compression::zstd;
+    else
+      m_format = compression::none;
+    m_slots.resize(std::max(2u, opts.depth));
+    m_thread = std::thread(&Decompress::run, this);
+  }
+  Decompress(const Decompress&) = delete;
+  Decompress& operator=(const Decompress&) = delete;
+  ~Decompress() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+    close(m_fd);
+  }
+
+  compression format() const { return m_format; }
+
+  std::string_view next() {
+    if(m_done)
+      return std::string_view();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_returned) {
+      m_slots[prev(m_cur)].ready = false;
+      m_cond.notify_all();
+    }
+    m_returned = true;
+    auto& s = m_slots[m_cur];
+    if(!s.ready) {
+      ENUMERABLE_TRACE_SCOPE("inflate pop wait");
+      m_cond.wait(lock, [&]() { return s.ready; });
+    }
+    m_cur = (m_cur + 1) % m_slots.size();
+    if(s.filled == 0) {
+      m_done = true;
+      if(m_error)
+        std::rethrow_exception(m_error);
+    }
+    return std::string_view(s.data.data(), s.filled);
+  }
+};
+
+} // namespace imp
+
+// Lines of the file path, decompressed on a background thread. The
+// compression (gzip, BGZF, zstd or none) is detected from the
+// content. BGZF blocks are decompressed on threads threads.
+inline imp::SplitLines<imp::Decompress> lines_compressed(const std::string& path, const read_options& opts = read_options(),
+                                                        char delim = '\n', unsigned threads = 1) {
+  return imp::SplitLines<imp::Decompress>(delim, path, opts, threads);
+}
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_COMPRESS_H__ */
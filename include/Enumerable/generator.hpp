@@ -0,0 +1,200 @@
+#ifndef __ENUMERABLE_GENERATOR_H__
+#define __ENUMERABLE_GENERATOR_H__
+
+#if !defined(__cpp_impl_coroutine)
+#error "Enumerable/generator.hpp requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <cstddef>
+#include <new>
+
+#include <Enumerable.hpp>
+
+namespace Enumerable {
+namespace imp {
+
+// Recycling allocator for the coroutine frames. Frames are rounded up
+// to a multiple of 64 bytes and freed frames are kept in per-thread
+// free lists, so creating many short lived generators does not go
+// through malloc. Large frames use the global operator new.
+class FramePool {
+  static const size_t granularity = 64;
+  static const size_t nb_classes  = 32;
+
+  struct node { node* next; };
+  node* m_free[nb_classes] = {};
+
+  static size_t size_class(size_t size) { return (size + granularity - 1) / granularity; }
+  static FramePool& local() {
+    static thread_local FramePool pool;
+    return pool;
+  }
+public:
+  ~FramePool() {
+    for(size_t i = 0; i < nb_classes; ++i) {
+      while(m_free[i]) {
+        node* n = m_free[i];
+        m_free[i] = n->next;
+        ::operator delete(n);
+      }
+    }
+  }
+
+  static void* allocate(size_t size) {
+    const size_t c = size_class(size);
+    if(c >= nb_classes)
+      return ::operator new(size);
+    auto& pool = local();
+    if(pool.m_free[c]) {
+      node* n = pool.m_free[c];
+      pool.m_free[c] = n->next;
+      return n;
+    }
+    return ::operator new(c * granularity);
+  }
+
+  static void deallocate(void* ptr, size_t size) {
+    const size_t c = size_class(size);
+    if(c >= nb_classes) {
+      ::operator delete(ptr);
+      return;
+    }
+    auto& pool = local();
+    node* n = static_cast<node*>(ptr);
+    n->next = pool.m_free[c];
+    pool.m_free[c] = n;
+  }
+};
+
+// Enumerable from a coroutine:
+//
+//   generator<int> fib() {
+//     int a = 0, b = 1;
+//     while(true) { co_yield a; std::tie(a, b) = std::make_tuple(b, a + b); }
+//   }
+//
+// A generator can also co_yield another generator of the same type,
+// in which case all the elements of the nested generator are yielded
+// in turn. The nested generators are resumed directly (symmetric
+// transfer), so the cost of an element does not depend on the depth
+// of nesting. Like IstreamLines, copies of a generator share the same
+// underlying coroutine.
+template<typename T>
+class Generator : public Base<Generator<T>, T> {
+public:
+  typedef T value_type;
+  typedef typename std::remove_const<T>::type stored_type;
+
+  class promise_type {
+    friend class Generator;
+    const stored_type*                 m_value  = nullptr;
+    promise_type*                      m_root   = this;
+    promise_type*                      m_leaf   = this; // Only meaningful in the root
+    std::coroutine_handle<promise_type> m_parent;
+    std::exception_ptr                 m_exception;
+    bool                               m_suspended = false;
+    size_t                             m_refs   = 1;
+
+    std::coroutine_handle<promise_type> handle() { return std::coroutine_handle<promise_type>::from_promise(*this); }
+
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        auto& p = h.promise();
+        if(p.m_parent) {
+          p.m_root->m_leaf = &p.m_parent.promise();
+          return p.m_parent;
+        }
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept { }
+    };
+
+    // The nested generator has already run up to its first element:
+    // attach it and its own nested generators below h, make its leaf
+    // the current leaf and return to the consumer.
+    struct nested_awaiter {
+      Generator m_nested;
+      bool await_ready() noexcept { return !m_nested.m_handle || m_nested.m_handle.done(); }
+      void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        auto& p          = h.promise();
+        auto& np         = m_nested.m_handle.promise();
+        np.m_parent      = h;
+        p.m_root->m_leaf = np.m_leaf;
+        for(promise_type* q = np.m_leaf; q != &p; q = &q->m_parent.promise())
+          q->m_root = p.m_root;
+      }
+      void await_resume() {
+        if(m_nested.m_handle && m_nested.m_handle.promise().m_exception)
+          std::rethrow_exception(std::exchange(m_nested.m_handle.promise().m_exception, nullptr));
+      }
+    };
+
+  public:
+    Generator get_return_object() { return Generator(handle()); }
+    std::suspend_never initial_suspend() noexcept { return {}; } // Run up to the first element
+    final_awaiter final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(const stored_type& x) noexcept {
+      m_value     = &x;
+      m_suspended = true;
+      return {};
+    }
+    nested_awaiter yield_value(Generator&& nested) noexcept { return nested_awaiter{std::move(nested)}; }
+    nested_awaiter yield_value(Generator& nested) noexcept { return nested_awaiter{nested}; }
+    void return_void() noexcept { }
+    // Propagate the exception to the consumer. Before the first
+    // suspension, the exception is kept until the generator is used.
+    void unhandled_exception() {
+      if(m_suspended) throw;
+      m_exception = std::current_exception();
+    }
+    template<typename U>
+    std::suspend_never await_transform(U&&) = delete; // No co_await in a generator
+
+    static void* operator new(size_t size) { return FramePool::allocate(size); }
+    static void operator delete(void* ptr, size_t size) { FramePool::deallocate(ptr, size); }
+  };
+
+protected:
+  std::coroutine_handle<promise_type> m_handle;
+
+  explicit Generator(std::coroutine_handle<promise_type> h) : m_handle(h) { }
+  void release() {
+    if(m_handle && --m_handle.promise().m_refs == 0)
+      m_handle.destroy();
+    m_handle = nullptr;
+  }
+
+public:
+  Generator() = default;
+  Generator(const Generator& rhs) : m_handle(rhs.m_handle) {
+    if(m_handle)
+      ++m_handle.promise().m_refs;
+  }
+  Generator(Generator&& rhs) noexcept : m_handle(std::exchange(rhs.m_handle, nullptr)) { }
+  ~Generator() { release(); }
+  Generator& operator=(Generator rhs) {
+    std::swap(m_handle, rhs.m_handle);
+    return *this;
+  }
+
+  operator bool() const {
+    if(m_handle && m_handle.promise().m_exception)
+      std::rethrow_exception(std::exchange(m_handle.promise().m_exception, nullptr));
+    return m_handle && !m_handle.done();
+  }
+  void operator++() { m_handle.promise().m_leaf->handle().resume(); }
+  const stored_type& operator*() const { return *m_handle.promise().m_leaf->m_value; }
+};
+
+} // namespace imp
+
+template<typename T>
+using generator = imp::Generator<T>;
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_GENERATOR_H__ */
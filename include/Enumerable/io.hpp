@@ -0,0 +1,1140 @@
+#ifndef __ENUMERABLE_IO_H__
+#define __ENUMERABLE_IO_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <charconv>
+#include <tuple>
+#include <system_error>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ENUMERABLE_HAVE_IO_URING 1
+#endif
+#endif
+
+#include <Enumerable.hpp>
+#include <Enumerable/parallel.hpp>
+
+namespace Enumerable {
+
+struct read_options {
+  size_t   buffer_size = 1 << 20; // Size of each read
+  unsigned depth       = 4;       // Number of buffers read ahead
+  bool     io_uring    = true;    // Use io_uring if available, otherwise a read thread
+};
+
+struct write_options {
+  size_t buffer_size = 1 << 20; // Size of each write, a multiple of 4096
+  bool   direct      = false;   // Open with O_DIRECT, bypassing the page cache
+};
+
+namespace imp {
+
+inline std::system_error io_error(const std::string& msg, int err = errno) {
+  return std::system_error(err, std::generic_category(), msg);
+}
+
+inline void write_all(int fd, const char* data, size_t size) {
+  while(size > 0) {
+    const ssize_t r = ::write(fd, data, size);
+    if(r < 0) {
+      if(errno == EINTR) continue;
+      throw io_error("write");
+    }
+    data += r;
+    size -= r;
+  }
+}
+
+// Buffer aligned on a page, suitable for O_DIRECT
+struct AlignedBuffer {
+  char*  data;
+  size_t size;
+  explicit AlignedBuffer(size_t s) : data(nullptr), size(s) {
+    if(posix_memalign(reinterpret_cast<void**>(&data), 4096, size))
+      throw std::bad_alloc();
+  }
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer(AlignedBuffer&& rhs) : data(rhs.data), size(rhs.size) { rhs.data = nullptr; }
+  ~AlignedBuffer() { free(data); }
+};
+
+#ifdef ENUMERABLE_HAVE_IO_URING
+// Minimal io_uring, using the system calls directly. Only one thread
+// submits and reaps.
+class Uring {
+  int                m_fd;
+  void*              m_sq_ring;
+  size_t             m_sq_ring_size;
+  void*              m_cq_ring;
+  size_t             m_cq_ring_size;
+  io_uring_sqe*      m_sqes;
+  size_t             m_sqes_size;
+  unsigned*          m_sq_tail;
+  unsigned           m_sq_mask;
+  unsigned*          m_sq_array;
+  unsigned*          m_cq_head;
+  unsigned*          m_cq_tail;
+  unsigned           m_cq_mask;
+  io_uring_cqe*      m_cqes;
+
+  static char* at(void* p, size_t off) { return static_cast<char*>(p) + off; }
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, nullptr, 0);
+  }
+  void release() {
+    if(m_sqes) munmap(m_sqes, m_sqes_size);
+    if(m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+    if(m_sq_ring != MAP_FAILED) munmap(m_sq_ring, m_sq_ring_size);
+    close(m_fd);
+  }
+
+public:
+  explicit Uring(unsigned entries) : m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_sqes(nullptr) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(m_fd < 0)
+      throw io_error("io_uring_setup");
+    m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single)
+      m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    m_cq_ring = single || m_sq_ring == MAP_FAILED ? m_sq_ring
+      : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes  = m_cq_ring == MAP_FAILED ? MAP_FAILED
+      : mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+      const int err = errno;
+      release();
+      throw io_error("io_uring mmap", err);
+    }
+    m_sqes     = static_cast<io_uring_sqe*>(sqes);
+    m_sq_tail  = reinterpret_cast<unsigned*>(at(m_sq_ring, p.sq_off.tail));
+    m_sq_mask  = *reinterpret_cast<unsigned*>(at(m_sq_ring, p.sq_off.ring_mask));
+    m_sq_array = reinterpret_cast<unsigned*>(at(m_sq_ring, p.sq_off.array));
+    m_cq_head  = reinterpret_cast<unsigned*>(at(m_cq_ring, p.cq_off.head));
+    m_cq_tail  = reinterpret_cast<unsigned*>(at(m_cq_ring, p.cq_off.tail));
+    m_cq_mask  = *reinterpret_cast<unsigned*>(at(m_cq_ring, p.cq_off.ring_mask));
+    m_cqes     = reinterpret_cast<io_uring_cqe*>(at(m_cq_ring, p.cq_off.cqes));
+  }
+  Uring(const Uring&) = delete;
+  Uring& operator=(const Uring&) = delete;
+  ~Uring() { release(); }
+
+  void submit(uint8_t opcode, int fd, const iovec* iov, off_t offset, uint64_t user_data) {
+    const unsigned tail = *m_sq_tail;
+    const unsigned i    = tail & m_sq_mask;
+    io_uring_sqe&  sqe  = m_sqes[i];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode    = opcode;
+    sqe.fd        = fd;
+    sqe.addr      = reinterpret_cast<uint64_t>(iov);
+    sqe.len       = 1;
+    sqe.off       = offset;
+    sqe.user_data = user_data;
+    m_sq_array[i] = i;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    while(enter(1, 0, 0) < 0) {
+      if(errno != EINTR && errno != EAGAIN)
+        throw io_error("io_uring_enter");
+    }
+  }
+
+  // Wait for one completion
+  io_uring_cqe wait() {
+    while(true) {
+      const unsigned head = *m_cq_head;
+      if(head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe res = m_cqes[head & m_cq_mask];
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+        return res;
+      }
+      if(enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        throw io_error("io_uring_enter");
+    }
+  }
+};
+#endif // ENUMERABLE_HAVE_IO_URING
+
+// Read a file sequentially with depth buffers in flight. With
+// io_uring, a read is submitted for every free buffer. Otherwise, a
+// background thread fills the buffers in order. next() returns the
+// next chunk of the file, valid until the following call to next(),
+// and an empty view at the end of the file.
+class ReadAhead {
+  struct slot {
+    AlignedBuffer buffer;
+    iovec         iov;
+    off_t         offset;
+    size_t        filled;
+    bool          ready;   // Read completed, data available
+    bool          busy;    // Read in flight
+    explicit slot(size_t s) : buffer(s), offset(0), filled(0), ready(false), busy(false) { }
+  };
+
+  int                          m_fd;
+  size_t                       m_buffer_size;
+  std::vector<slot>            m_slots;
+  size_t                       m_cur;        // Slot to return next
+  bool                         m_returned;   // m_cur - 1 is held by the consumer
+  bool                         m_done;       // End of file returned
+  off_t                        m_offset;     // Offset of next read
+  off_t                        m_size;       // File size (uring backend)
+#ifdef ENUMERABLE_HAVE_IO_URING
+  std::unique_ptr<Uring>       m_uring;
+#endif
+  // Thread backend
+  std::thread                  m_thread;
+  std::mutex                   m_mutex;
+  std::condition_variable      m_cond;
+  bool                         m_stop;
+  int                          m_error;
+
+  size_t prev(size_t i) const { return (i + m_slots.size() - 1) % m_slots.size(); }
+
+#ifdef ENUMERABLE_HAVE_IO_URING
+  void submit(size_t i) {
+    auto& s = m_slots[i];
+    s.iov.iov_base = s.buffer.data + s.filled;
+    s.iov.iov_len  = std::min(m_buffer_size, (size_t)(m_size - s.offset)) - s.filled;
+    s.busy         = true;
+    m_uring->submit(IORING_OP_READV, m_fd, &s.iov, s.offset + s.filled, i);
+  }
+  void issue(size_t i) {
+    auto& s = m_slots[i];
+    s.ready = false;
+    if(m_offset >= m_size) {
+      s.filled = 0;
+      s.ready  = true;
+      return;
+    }
+    s.offset  = m_offset;
+    s.filled  = 0;
+    m_offset += std::min((off_t)m_buffer_size, m_size - m_offset);
+    submit(i);
+  }
+  void reap() {
+    const io_uring_cqe cqe = m_uring->wait();
+    auto& s = m_slots[cqe.user_data];
+    s.busy  = false;
+    if(cqe.res < 0) {
+      if(cqe.res == -EINTR || cqe.res == -EAGAIN)
+        return submit(cqe.user_data);
+      throw io_error("read", -cqe.res);
+    }
+    s.filled += cqe.res;
+    if(cqe.res > 0 && s.filled < std::min(m_buffer_size, (size_t)(m_size - s.offset)))
+      return submit(cqe.user_data); // Short read
+    s.ready = true;
+  }
+  std::string_view next_uring() {
+    if(m_returned)
+      issue(prev(m_cur));
+    m_returned = true;
+    auto& s = m_slots[m_cur];
+    while(!s.ready)
+      reap();
+    m_cur = (m_cur + 1) % m_slots.size();
+    return std::string_view(s.buffer.data, s.filled);
+  }
+#endif
+
+  void read_thread() {
+    for(size_t i = 0; ; i = (i + 1) % m_slots.size()) {
+      auto& s = m_slots[i];
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(!m_stop && s.ready) {
+          ENUMERABLE_TRACE_SCOPE("read push wait");
+          m_cond.wait(lock, [&]() { return m_stop || !s.ready; });
+        }
+        if(m_stop) return;
+      }
+      s.filled = 0;
+      int err  = 0;
+      while(s.filled < m_buffer_size) {
+        const ssize_t r = ::read(m_fd, s.buffer.data + s.filled, m_buffer_size - s.filled);
+        if(r == 0) break;
+        if(r < 0) {
+          if(errno == EINTR) continue;
+          err = errno;
+          break;
+        }
+        s.filled += r;
+      }
+      std::lock_guard<std::mutex> lock(m_mutex);
+      s.ready = true;
+      m_error = err;
+      m_cond.notify_all();
+      if(s.filled == 0 || err)
+        return;
+    }
+  }
+  std::string_view next_thread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_returned) {
+      m_slots[prev(m_cur)].ready = false;
+      m_cond.notify_all();
+    }
+    m_returned = true;
+    auto& s = m_slots[m_cur];
+    if(!s.ready) {
+      ENUMERABLE_TRACE_SCOPE("read pop wait");
+      m_cond.wait(lock, [&]() { return s.ready; });
+    }
+    if(m_error)
+      throw io_error("read", m_error);
+    m_cur = (m_cur + 1) % m_slots.size();
+    return std::string_view(s.buffer.data, s.filled);
+  }
+
+public:
+  ReadAhead(const std::string& path, const read_options& opts = read_options())
+    : m_buffer_size(opts.buffer_size), m_cur(0), m_returned(false), m_done(false), m_offset(0), m_size(0)
+    , m_stop(false), m_error(0)
+  {
+    m_fd = open(path.c_str(), O_RDONLY);
+    if(m_fd == -1)
+      throw io_error("Can't open '" + path + "'");
+    struct stat st;
+    const bool regular = fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode);
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    const unsigned depth = std::max(2u, opts.depth);
+    m_slots.reserve(depth);
+    for(unsigned i = 0; i < depth; ++i)
+      m_slots.emplace_back(m_buffer_size);
+#ifdef ENUMERABLE_HAVE_IO_URING
+    if(opts.io_uring && regular) {
+      try {
+        m_uring.reset(new Uring(depth));
+      } catch(std::system_error&) { } // io_uring not supported or not allowed. Use a thread.
+    }
+    if(m_uring) {
+      m_size = st.st_size;
+      for(size_t i = 0; i < m_slots.size(); ++i)
+        issue(i);
+      return;
+    }
+#endif
+    m_thread = std::thread(&ReadAhead::read_thread, this);
+  }
+  ReadAhead(const ReadAhead&) = delete;
+  ReadAhead& operator=(const ReadAhead&) = delete;
+  ~ReadAhead() {
+#ifdef ENUMERABLE_HAVE_IO_URING
+    if(m_uring) {
+      // The kernel may still be writing in the buffers
+      for(auto& s : m_slots) {
+        while(s.busy) {
+          try { reap(); } catch(std::system_error&) { }
+        }
+      }
+    }
+#endif
+    if(m_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+      }
+      m_cond.notify_all();
+      m_thread.join();
+    }
+    close(m_fd);
+  }
+
+  bool uses_io_uring() const {
+#ifdef ENUMERABLE_HAVE_IO_URING
+    return (bool)m_uring;
+#else
+    return false;
+#endif
+  }
+
+  std::string_view next() {
+    if(m_done)
+      return std::string_view();
+#ifdef ENUMERABLE_HAVE_IO_URING
+    const std::string_view res = m_uring ? next_uring() : next_thread();
+#else
+    const std::string_view res = next_thread();
+#endif
+    m_done = res.empty();
+    return res;
+  }
+};
+
+// Blocks of a file, as read by ReadAhead. Copies share the same
+// reader.
+class Blocks : public Base<Blocks, std::string_view> {
+  struct state {
+    ReadAhead        reader;
+    std::string_view block;
+    state(const std::string& path, const read_options& opts) : reader(path, opts) { }
+  };
+  std::shared_ptr<state> m_state;
+public:
+  typedef std::string_view value_type;
+  Blocks(const std::string& path, const read_options& opts = read_options())
+    : m_state(std::make_shared<state>(path, opts))
+  { operator++(); }
+  operator bool() const { return !m_state->block.empty(); }
+  void operator++() { m_state->block = m_state->reader.next(); }
+  value_type operator*() const { return m_state->block; }
+};
+
+// Split into lines (or records ending with delim) the chunks returned
+// by Source::next(), an empty chunk meaning the end of the input. The
+// lines are views into the chunks and are valid until the next
+// increment; only the lines spanning two chunks are copied. The
+// separator is found with memchr, which is vectorized in the C
+// library. Copies share the same state.
+template<typename Source>
+class SplitLines : public Base<SplitLines<Source>, std::string_view> {
+  struct state {
+    Source           source;
+    const char*      pos  = nullptr;
+    const char*      end  = nullptr;
+    std::string      carry;             // Line spanning chunks
+    std::string_view line;
+    bool             has_line = false;
+    char             delim;
+    template<typename... Args>
+    state(char d, Args&&... args) : source(std::forward<Args>(args)...), delim(d) { }
+  };
+  std::shared_ptr<state> m_state;
+public:
+  typedef std::string_view value_type;
+
+  template<typename... Args>
+  explicit SplitLines(char delim, Args&&... args)
+    : m_state(std::make_shared<state>(delim, std::forward<Args>(args)...))
+  { operator++(); }
+
+  operator bool() const { return m_state->has_line; }
+  void operator++() {
+    auto& s = *m_state;
+    s.carry.clear();
+    while(true) {
+      if(s.pos == s.end) {
+        const std::string_view chunk = s.source.next();
+        if(chunk.empty()) {
+          s.has_line = !s.carry.empty();
+          s.line     = s.carry;
+          return;
+        }
+        s.pos = chunk.data();
+        s.end = chunk.data() + chunk.size();
+      }
+      const char* nl = static_cast<const char*>(memchr(s.pos, s.delim, s.end - s.pos));
+      if(!nl) {
+        s.carry.append(s.pos, s.end);
+        s.pos = s.end;
+        continue;
+      }
+      if(s.carry.empty()) {
+        s.line = std::string_view(s.pos, nl - s.pos);
+      } else {
+        s.carry.append(s.pos, nl);
+        s.line = s.carry;
+      }
+      s.pos      = nl + 1;
+      s.has_line = true;
+      return;
+    }
+  }
+  value_type operator*() const { return m_state->line; }
+};
+
+// Read only memory mapping of a whole file
+class MappedFile {
+  void*  m_data;
+  size_t m_size;
+public:
+  explicit MappedFile(const std::string& path) : m_data(nullptr), m_size(0) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1)
+      throw io_error("Can't open '" + path + "'");
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+      const int err = errno;
+      close(fd);
+      throw io_error("Can't stat '" + path + "'", err);
+    }
+    m_size = st.st_size;
+    if(m_size > 0) {
+      m_data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(m_data == MAP_FAILED) {
+        const int err = errno;
+        close(fd);
+        throw io_error("Can't map '" + path + "'", err);
+      }
+    }
+    close(fd);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() {
+    if(m_data)
+      munmap(m_data, m_size);
+  }
+  const char* data() const { return static_cast<const char*>(m_data); }
+  size_t size() const { return m_size; }
+  void advise(int advice) const {
+    if(m_data)
+      madvise(m_data, m_size, advice);
+  }
+};
+
+// A chunk source returning one chunk of memory, for SplitLines
+class MemorySource {
+  std::string_view m_data;
+public:
+  explicit MemorySource(std::string_view data) : m_data(data) { }
+  std::string_view next() { return std::exchange(m_data, std::string_view()); }
+};
+
+// A chunk source reading an istream by blocks of size bytes
+class IstreamSource {
+  std::istream&     m_is;
+  std::vector<char> m_buffer;
+public:
+  explicit IstreamSource(std::istream& is, size_t size = 1 << 16) : m_is(is), m_buffer(size) { }
+  std::string_view next() {
+    m_is.read(m_buffer.data(), m_buffer.size());
+    return std::string_view(m_buffer.data(), m_is.gcount());
+  }
+};
+
+// Parallel operations on an input split in ranges (byte ranges of a
+// file, files of a list...). Derived provides ranges(), range(i),
+// returning the lines of the range i, and threads().
+template<typename Derived>
+class ParRanges {
+  const Derived& self() const { return static_cast<const Derived&>(*this); }
+
+public:
+  // Apply f to the lines of every range, in parallel. Return the
+  // results in range order.
+  template<typename F>
+  auto map_ranges(F f) const {
+    std::vector<decltype(f(self().range(0)))> res(self().ranges());
+    parallel_for(self().ranges(), self().threads(), [&](size_t i) { res[i] = f(self().range(i)); });
+    return res;
+  }
+
+  // Call b on every line, concurrently and in no particular order
+  template<typename Block>
+  void each(Block b) const {
+    parallel_for(self().ranges(), self().threads(), [&](size_t i) { self().range(i).each(b); });
+  }
+
+  // Inject every range with b starting from start, then combine the
+  // results of the ranges in order: combine(combine(r0, r1), r2)...
+  // start must be an identity for combine.
+  template<typename U, typename Block, typename Combine>
+  U inject(const U& start, Block b, Combine combine) const {
+    if(self().ranges() == 0)
+      return start;
+    auto res = map_ranges([&](auto ls) { return ls.inject(U(start), b); });
+    U acc = std::move(res[0]);
+    for(size_t i = 1; i < res.size(); ++i)
+      acc = combine(std::move(acc), std::move(res[i]));
+    return acc;
+  }
+
+  // Run the pipeline f (a function from the lines of a range to an
+  // enumerable) on every range and append the elements to
+  // c. Elements are in range order if ordered is true, otherwise
+  // ranges are appended as they complete.
+  template<typename F, typename Container>
+  void collect(F f, Container& c, bool ordered = true) const {
+    if(ordered) {
+      for(auto& part : map_ranges([&](auto ls) { Container part; f(ls).collect(part); return part; }))
+        c.insert(c.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+      return;
+    }
+    std::mutex mtx;
+    parallel_for(self().ranges(), self().threads(), [&](size_t i) {
+        Container part;
+        f(self().range(i)).collect(part);
+        std::lock_guard<std::mutex> lock(mtx);
+        c.insert(c.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+      });
+  }
+};
+
+// Lines of a file split in byte ranges processed in parallel. The
+// boundaries of the ranges are moved to the start of the next line,
+// and each range is split into lines with SplitLines. The downstream
+// pipeline runs independently on each range.
+class ParLines : public ParRanges<ParLines> {
+  std::shared_ptr<MappedFile> m_file;
+  unsigned                    m_threads;
+  std::vector<size_t>         m_bounds;
+  char                        m_delim;
+
+public:
+  typedef SplitLines<MemorySource> lines_type;
+
+  ParLines(const std::string& path, unsigned threads, size_t ranges = 0, char delim = '\n')
+    : m_file(std::make_shared<MappedFile>(path))
+    , m_threads(std::max(1u, threads))
+    , m_delim(delim)
+  {
+    m_file->advise(MADV_SEQUENTIAL);
+    const size_t size = m_file->size();
+    const char*  data = m_file->data();
+    if(ranges == 0)
+      ranges = 4 * m_threads; // For load balancing
+    ranges = std::max((size_t)1, std::min(ranges, size / 4096));
+    m_bounds.push_back(0);
+    for(size_t i = 1; i < ranges; ++i) {
+      size_t b = std::max(m_bounds.back(), size * i / ranges);
+      if(b == 0 || b >= size) continue;
+      const void* nl = memchr(data + b - 1, m_delim, size - b + 1);
+      b = nl ? static_cast<const char*>(nl) - data + 1 : size;
+      if(b > m_bounds.back() && b < size)
+        m_bounds.push_back(b);
+    }
+    m_bounds.push_back(size);
+  }
+
+  size_t ranges() const { return m_bounds.size() - 1; }
+  unsigned threads() const { return m_threads; }
+
+  // Lines of the range i
+  lines_type range(size_t i) const {
+    return lines_type(m_delim, std::string_view(m_file->data() + m_bounds[i], m_bounds[i + 1] - m_bounds[i]));
+  }
+};
+
+// A chunk source reading a file synchronously with read(2), for
+// files too small to be worth a read ahead
+class FileSource {
+  int               m_fd;
+  std::vector<char> m_buffer;
+public:
+  FileSource(const std::string& path, size_t size) : m_buffer(size) {
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(m_fd == -1)
+      throw io_error("Can't open '" + path + "'");
+  }
+  FileSource(const FileSource&) = delete;
+  FileSource& operator=(const FileSource&) = delete;
+  ~FileSource() { close(m_fd); }
+  std::string_view next() {
+    while(true) {
+      const ssize_t r = ::read(m_fd, m_buffer.data(), m_buffer.size());
+      if(r >= 0)
+        return std::string_view(m_buffer.data(), r);
+      if(errno != EINTR)
+        throw io_error("read");
+    }
+  }
+};
+
+// Paths of the regular files in a directory and its subdirectories
+// whose name matches a glob pattern (see fnmatch(3); names starting
+// with a dot must be matched explicitly, like in the shell). The
+// directories are read with getdents64 in large buffers and stat is
+// only called when the file system does not report the type of the
+// entries. Symbolic links to files are returned, symbolic links to
+// directories are not followed. The order is the order of the
+// directory entries, directories being visited breadth first. Copies
+// share the same state.
+class Files : public Base<Files, std::string> {
+  struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+  };
+  struct state {
+    std::string             glob;
+    bool                    recursive;
+    std::deque<std::string> dirs; // Directories left to read
+    std::string             dir;  // Directory being read
+    int                     fd = -1;
+    std::vector<char>       buffer;
+    size_t                  pos = 0, end = 0;
+    std::string             path;
+    bool                    has_path = false;
+    state(std::string g, bool r) : glob(std::move(g)), recursive(r), buffer(1 << 17) { }
+    ~state() { if(fd != -1) close(fd); }
+  };
+  std::shared_ptr<state> m_state;
+
+  static int open_dir(const std::string& path) {
+    return open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  static std::string join(const std::string& dir, const char* name) {
+    std::string res(dir);
+    if(res.empty() || res.back() != '/')
+      res += '/';
+    return res += name;
+  }
+
+public:
+  typedef std::string value_type;
+
+  // DT_REG or DT_DIR for the entry name of the directory dirfd, of
+  // type type as returned by getdents64, or DT_UNKNOWN to skip
+  // it. The type is unknown on some file systems: stat is
+  // called. Symbolic links to regular files are followed, not those to
+  // directories (no loops).
+  static unsigned char entry_type(int dirfd, const char* name, unsigned char type) {
+    if(type != DT_UNKNOWN && type != DT_LNK)
+      return type == DT_REG || type == DT_DIR ? type : DT_UNKNOWN;
+    struct stat st;
+    if(fstatat(dirfd, name, &st, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) == -1)
+      return DT_UNKNOWN; // Dangling link or removed file
+    if(S_ISLNK(st.st_mode)) {
+      type = DT_LNK;
+      if(fstatat(dirfd, name, &st, 0) == -1)
+        return DT_UNKNOWN;
+    }
+    if(S_ISREG(st.st_mode))
+      return DT_REG;
+    return S_ISDIR(st.st_mode) && type == DT_UNKNOWN ? DT_DIR : DT_UNKNOWN;
+  }
+
+  Files(const std::string& dir, const std::string& glob = "*", bool recursive = true)
+    : m_state(std::make_shared<state>(glob, recursive))
+  {
+    // Fail early on the top directory. Subdirectories which can't be
+    // read are skipped.
+    m_state->fd = open_dir(dir);
+    if(m_state->fd == -1)
+      throw io_error("Can't open directory '" + dir + "'");
+    m_state->dir = dir;
+    operator++();
+  }
+
+  operator bool() const { return m_state->has_path; }
+  const std::string& operator*() const { return m_state->path; }
+  void operator++() {
+    auto& s = *m_state;
+    while(true) {
+      if(s.pos == s.end) {
+        if(s.fd == -1) {
+          if(s.dirs.empty()) {
+            s.has_path = false;
+            return;
+          }
+          s.dir = std::move(s.dirs.front());
+          s.dirs.pop_front();
+          s.fd  = open_dir(s.dir);
+          continue;
+        }
+        const long r = syscall(SYS_getdents64, s.fd, s.buffer.data(), s.buffer.size());
+        if(r < 0) {
+          if(errno == EINTR) continue;
+          throw io_error("Can't read directory '" + s.dir + "'");
+        }
+        if(r == 0) {
+          close(s.fd);
+          s.fd = -1;
+        }
+        s.pos = 0;
+        s.end = r;
+        continue;
+      }
+
+      const linux_dirent64* d = reinterpret_cast<const linux_dirent64*>(s.buffer.data() + s.pos);
+      s.pos += d->d_reclen;
+      const char* name = d->d_name;
+      if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+      const unsigned char type = entry_type(s.fd, name, d->d_type);
+      if(type == DT_DIR) {
+        if(s.recursive)
+          s.dirs.push_back(join(s.dir, name));
+      } else if(type == DT_REG && fnmatch(s.glob.c_str(), name, FNM_PERIOD) == 0) {
+        s.path     = join(s.dir, name);
+        s.has_path = true;
+        return;
+      }
+    }
+  }
+};
+
+// Lines of a list of files, the files being processed in parallel:
+// every file is a range for the ParRanges operations. Files are read
+// synchronously with buffers of buffer_size bytes, the parallelism
+// coming from working on many files at once.
+class ParFiles : public ParRanges<ParFiles> {
+  std::shared_ptr<std::vector<std::string>> m_paths;
+  unsigned                                  m_threads;
+  size_t                                    m_buffer_size;
+  char                                      m_delim;
+
+public:
+  typedef SplitLines<FileSource> lines_type;
+
+  template<typename Enum>
+  ParFiles(Enum paths, unsigned threads, size_t buffer_size = 1 << 16, char delim = '\n')
+    : m_paths(std::make_shared<std::vector<std::string>>())
+    , m_threads(std::max(1u, threads))
+    , m_buffer_size(buffer_size)
+    , m_delim(delim)
+  {
+    for( ; paths; ++paths)
+      m_paths->emplace_back(*paths);
+  }
+
+  size_t ranges() const { return m_paths->size(); }
+  unsigned threads() const { return m_threads; }
+  const std::string& path(size_t i) const { return (*m_paths)[i]; }
+
+  // Lines of the file i
+  lines_type range(size_t i) const { return lines_type(m_delim, path(i), m_buffer_size); }
+};
+
+// Records of type T of a binary file. The file is memory mapped and
+// the records are returned by reference into the mapping. Copies
+// share the mapping but not the position.
+template<typename T>
+class Records : public Base<Records<T>, T> {
+  static_assert(std::is_trivially_copyable<T>::value, "Records must be trivially copyable");
+  std::shared_ptr<MappedFile> m_file;
+  const T*                    m_cur;
+  const T*                    m_end;
+public:
+  typedef T value_type;
+  explicit Records(const std::string& path) : m_file(std::make_shared<MappedFile>(path)) {
+    if(m_file->size() % sizeof(T))
+      throw std::runtime_error("Size of '" + path + "' is not a multiple of the record size");
+    m_file->advise(MADV_SEQUENTIAL);
+    m_cur = reinterpret_cast<const T*>(m_file->data());
+    m_end = m_cur + m_file->size() / sizeof(T);
+  }
+  operator bool() const { return m_cur < m_end; }
+  void operator++() { ++m_cur; }
+  const T& operator*() const { return *m_cur; }
+};
+
+// Write to a file through a large aligned buffer, one write system
+// call per buffer. With O_DIRECT, the last partial buffer is written
+// after switching O_DIRECT off.
+class BlockWriter {
+  int           m_fd;
+  AlignedBuffer m_buffer;
+  size_t        m_used;
+  size_t        m_written;
+  bool          m_direct;
+
+public:
+  BlockWriter(const std::string& path, const write_options& opts = write_options())
+    : m_fd(-1), m_buffer((std::max(opts.buffer_size, (size_t)4096) + 4095) & ~(size_t)4095), m_used(0), m_written(0), m_direct(false)
+  {
+    if(opts.direct) {
+      m_fd     = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+      m_direct = m_fd != -1;
+    }
+    if(m_fd == -1) // Not requested or not supported by the file system
+      m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(m_fd == -1)
+      throw io_error("Can't open '" + path + "'");
+  }
+  BlockWriter(const BlockWriter&) = delete;
+  BlockWriter& operator=(const BlockWriter&) = delete;
+  ~BlockWriter() {
+    if(m_fd != -1) {
+      try { close(); } catch(std::system_error&) { }
+    }
+  }
+
+  void append(const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while(size > 0) {
+      const size_t n = std::min(size, m_buffer.size - m_used);
+      memcpy(m_buffer.data + m_used, p, n);
+      m_used += n;
+      p      += n;
+      size   -= n;
+      if(m_used == m_buffer.size)
+        flush();
+    }
+  }
+
+  // Space available in the buffer, at least n bytes
+  char* reserve(size_t n) {
+    if(m_buffer.size - m_used < n)
+      flush();
+    return m_buffer.data + m_used;
+  }
+  void commit(size_t n) { m_used += n; }
+  size_t capacity() const { return m_buffer.size; }
+
+  void flush() {
+    if(m_used == 0) return;
+    if(m_direct && m_used % 4096) {
+      fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+      m_direct = false;
+    }
+    write_all(m_fd, m_buffer.data, m_used);
+    m_written += m_used;
+    m_used     = 0;
+  }
+
+  void close() {
+    if(m_fd == -1) return;
+    try {
+      flush();
+    } catch(...) {
+      ::close(m_fd);
+      m_fd = -1;
+      throw;
+    }
+    const int res = ::close(m_fd);
+    m_fd = -1;
+    if(res == -1)
+      throw io_error("close");
+  }
+
+  // Number of bytes appended so far
+  size_t written() const { return m_written + m_used; }
+};
+
+// Output iterator writing the binary representation of T to a BlockWriter
+template<typename T>
+class RecordOutput {
+  static_assert(std::is_trivially_copyable<T>::value, "Records must be trivially copyable");
+  BlockWriter* m_writer;
+public:
+  typedef BlockWriter               writer_type;
+  typedef std::output_iterator_tag iterator_category;
+  typedef void                     value_type;
+  typedef void                     difference_type;
+  typedef void                     pointer;
+  typedef void                     reference;
+
+  explicit RecordOutput(BlockWriter& w) : m_writer(&w) { }
+  RecordOutput& operator=(const T& x) {
+    m_writer->append(&x, sizeof(T));
+    return *this;
+  }
+  RecordOutput& operator*() { return *this; }
+  RecordOutput& operator++() { return *this; }
+};
+
+// Formatting of an element as text for LinePrinter: bound() is an
+// upper bound on the size, write() writes the text and returns the end
+// of it. Numbers are formatted with to_chars, strings are copied, the
+// elements of tuples are separated by tabs and anything else goes
+// through operator<<.
+template<typename T, typename = void>
+struct Format {
+  // Text of the element formatted last, by bound(), reused by write()
+  // for the same element
+  struct last {
+    std::ostringstream os;
+    std::string        text;
+    const T*           x = nullptr;
+  };
+  static last& cache() {
+    static thread_local last res;
+    return res;
+  }
+  static const std::string& text(const T& x) {
+    last& c = cache();
+    if(c.x != &x) {
+      c.os.str(std::string());
+      c.os << x;
+      c.text = c.os.str();
+      c.x    = &x;
+    }
+    return c.text;
+  }
+  static size_t bound(const T& x) {
+    cache().x = nullptr; // Same address, maybe a new value
+    return text(x).size();
+  }
+  static char* write(char* p, const T& x) {
+    const std::string& s = text(x);
+    return static_cast<char*>(memcpy(p, s.data(), s.size())) + s.size();
+  }
+};
+
+// The char types are written as characters, as by operator<<
+template<typename T>
+struct Format<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+  static const size_t max_size = 32;
+  static size_t bound(const T&) { return max_size; }
+  static char* write(char* p, const T& x) {
+    if constexpr(std::is_same<T, char>::value || std::is_same<T, signed char>::value || std::is_same<T, unsigned char>::value) {
+      *p = x;
+      return p + 1;
+    } else if constexpr(std::is_same<T, bool>::value) {
+      return std::to_chars(p, p + max_size, (int)x).ptr;
+    } else {
+      return std::to_chars(p, p + max_size, x).ptr;
+    }
+  }
+};
+
+template<typename T>
+struct Format<T, typename std::enable_if<std::is_convertible<const T&, std::string_view>::value>::type> {
+  static size_t bound(const T& x) { return std::string_view(x).size(); }
+  static char* write(char* p, const T& x) {
+    const std::string_view s(x);
+    return static_cast<char*>(memcpy(p, s.data(), s.size())) + s.size();
+  }
+};
+
+template<typename... Ts>
+struct Format<std::tuple<Ts...>> {
+  typedef std::tuple<Ts...> tuple_type;
+  template<size_t... I>
+  static size_t bound(const tuple_type& x, std::index_sequence<I...>) {
+    return (sizeof...(Ts) + ... + Format<typename std::decay<Ts>::type>::bound(std::get<I>(x)));
+  }
+  template<size_t... I>
+  static char* write(char* p, const tuple_type& x, std::index_sequence<I...>) {
+    ((p = Format<typename std::decay<Ts>::type>::write(p, std::get<I>(x)), *p++ = '\t'), ...);
+    return p - (sizeof...(Ts) > 0);
+  }
+  static size_t bound(const tuple_type& x) { return bound(x, std::index_sequence_for<Ts...>()); }
+  static char* write(char* p, const tuple_type& x) { return write(p, x, std::index_sequence_for<Ts...>()); }
+};
+
+// Format the elements of an enumerable, one per line, in a buffer and
+// pass the full buffers to flush(data, size). The buffer is thread
+// local and reused from call to call.
+template<typename Enum>
+struct LinePrinter {
+  template<typename Flush>
+  static size_t run(Enum& e, size_t buffer_size, Flush flush) {
+    static thread_local std::vector<char> tl_buffer;
+    static thread_local bool              tl_used = false;
+    std::vector<char>                     own_buffer;
+    // Recursive call (printing while printing): use a new buffer
+    std::vector<char>& buffer = tl_used ? own_buffer : tl_buffer;
+    const bool         owner  = !tl_used;
+    tl_used = true;
+    struct release { bool owner; ~release() { if(owner) tl_used = false; } } r { owner };
+    buffer_size = std::max(buffer_size, (size_t)64);
+    if(buffer.size() < buffer_size)
+      buffer.resize(buffer_size);
+
+    char* const start = buffer.data();
+    char* const end   = start + buffer_size;
+    char*       p     = start;
+    size_t      n     = 0;
+    for( ; e; ++e, ++n) {
+      const auto& x = *e;
+      typedef Format<typename std::decay<decltype(x)>::type> format;
+      const size_t need = format::bound(x) + 1;
+      if((size_t)(end - p) < need) {
+        flush(start, p - start);
+        p = start;
+        if(need > buffer_size) { // Too large for the buffer
+          std::string tmp(need, '\0');
+          tmp.resize(format::write(&tmp[0], x) - tmp.data());
+          tmp += '\n';
+          flush(tmp.data(), tmp.size());
+          continue;
+        }
+      }
+      p    = format::write(p, x);
+      *p++ = '\n';
+    }
+    if(p > start)
+      flush(start, p - start);
+    return n;
+  }
+
+  static size_t to_fd(Enum& e, int fd, size_t buffer_size) {
+    return run(e, buffer_size, [fd](const char* data, size_t size) { write_all(fd, data, size); });
+  }
+  static size_t to_path(Enum& e, const std::string& path, size_t buffer_size) {
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd == -1)
+      throw io_error("Can't open '" + path + "'");
+    size_t res;
+    try {
+      res = to_fd(e, fd, buffer_size);
+    } catch(...) {
+      close(fd);
+      throw;
+    }
+    if(close(fd) == -1)
+      throw io_error("close");
+    return res;
+  }
+  static size_t to_stream(Enum& e, std::ostream& os, size_t buffer_size) {
+    return run(e, buffer_size, [&os](const char* data, size_t size) { os.write(data, size); });
+  }
+};
+
+} // namespace imp
+
+// Binary records of type T of the file path
+template<typename T>
+imp::Records<T> records(const std::string& path) { return imp::Records<T>(path); }
+
+// Blocks of the file path, read ahead asynchronously
+inline imp::Blocks file_blocks(const std::string& path, const read_options& opts = read_options()) {
+  return imp::Blocks(path, opts);
+}
+
+// Lines of the file path, as string views, read ahead asynchronously
+inline imp::SplitLines<imp::ReadAhead> file_lines(const std::string& path, const read_options& opts = read_options(), char delim = '\n') {
+  return imp::SplitLines<imp::ReadAhead>(delim, path, opts);
+}
+
+// Lines of the file path split in ranges processed by threads threads
+inline imp::ParLines par_lines(const std::string& path, unsigned threads, size_t ranges = 0, char delim = '\n') {
+  return imp::ParLines(path, threads, ranges, delim);
+}
+
+// Regular files in dir and its subdirectories matching glob
+inline imp::Files files(const std::string& dir, const std::string& glob = "*", bool recursive = true) {
+  return imp::Files(dir, glob, recursive);
+}
+
+// Lines of the files of paths (e.g. files(dir, glob)), processed in
+// parallel by threads threads
+template<typename Enum>
+imp::ParFiles par_files(Enum paths, unsigned threads, size_t buffer_size = 1 << 16, char delim = '\n') {
+  return imp::ParFiles(paths, threads, buffer_size, delim);
+}
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_IO_H__ */
@@ -0,0 +1,578 @@
+#ifndef __ENUMERABLE_PARALLEL_H__
+#define __ENUMERABLE_PARALLEL_H__
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Enumerable.hpp>
+#include <Enumerable/trace.hpp>
+
+namespace Enumerable {
+
+struct pool_options {
+  unsigned threads  = 0;     // Number of threads, the calling thread included. 0 for one per CPU.
+  bool     affinity = false; // Pin every worker thread to a CPU
+  bool     numa     = false; // Place the workers node by node, and steal from the same node first
+};
+
+namespace imp {
+
+struct Task {
+  void (*run)(Task*);
+};
+
+// Chase-Lev work-stealing deque (Lê et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models"). The owner pushes and pops
+// at the bottom, other threads steal from the top.
+class WorkDeque {
+  struct array {
+    size_t                                mask;
+    std::unique_ptr<std::atomic<Task*>[]> items;
+    explicit array(size_t size) : mask(size - 1), items(new std::atomic<Task*>[size]) { }
+    size_t size() const { return mask + 1; }
+    Task* get(int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+    void put(int64_t i, Task* t) { items[i & mask].store(t, std::memory_order_relaxed); }
+  };
+
+  alignas(64) std::atomic<int64_t>    m_top;
+  alignas(64) std::atomic<int64_t>    m_bottom;
+  std::atomic<array*>                 m_array;
+  std::vector<std::unique_ptr<array>> m_arrays; // Thieves may still read old arrays: freed with the deque
+
+  array* grow(array* a, int64_t t, int64_t b) {
+    m_arrays.emplace_back(new array(2 * a->size()));
+    array* n = m_arrays.back().get();
+    for(int64_t i = t; i < b; ++i)
+      n->put(i, a->get(i));
+    m_array.store(n, std::memory_order_release);
+    return n;
+  }
+
+public:
+  explicit WorkDeque(size_t size = 64) : m_top(0), m_bottom(0) {
+    m_arrays.emplace_back(new array(size));
+    m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+  }
+  WorkDeque(const WorkDeque&) = delete;
+  WorkDeque& operator=(const WorkDeque&) = delete;
+
+  // Owner only
+  void push(Task* t) {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    const int64_t s = m_top.load(std::memory_order_acquire);
+    array*        a = m_array.load(std::memory_order_relaxed);
+    if(b - s > (int64_t)a->size() - 1)
+      a = grow(a, s, b);
+    a->put(b, t);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Owner only
+  Task* pop() {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    array*        a = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if(t > b) { // Empty
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task* res = a->get(b);
+    if(t == b) { // Last element: race with the thieves
+      if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        res = nullptr;
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return res;
+  }
+
+  // Any thread. Returns nullptr if empty or if the race with another
+  // thread is lost.
+  Task* steal() {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = m_bottom.load(std::memory_order_acquire);
+    if(t >= b)
+      return nullptr;
+    Task* res = m_array.load(std::memory_order_acquire)->get(t);
+    if(!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return nullptr;
+    return res;
+  }
+
+  bool empty() const {
+    return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+  }
+};
+
+// Work-stealing thread pool. Every worker owns a WorkDeque: tasks
+// created by a worker are pushed on its own deque, and idle workers
+// steal from the others. Tasks submitted from other threads go
+// through a shared queue. A thread waiting for its tasks executes
+// tasks itself, so nested parallel loops run on the same workers
+// instead of creating more threads.
+class Pool {
+  struct worker {
+    WorkDeque             deque;
+    std::vector<unsigned> victims; // Order in which to steal from the other workers
+    int                   cpu  = -1;
+    int                   node = 0;
+  };
+
+  std::vector<std::unique_ptr<worker>> m_workers;
+  std::vector<std::thread>             m_threads;
+  std::mutex                           m_mutex;
+  std::condition_variable              m_cond;
+  std::deque<Task*>                    m_injected; // Tasks from outside threads
+  uint64_t                             m_epoch;    // Incremented when tasks are submitted
+  bool                                 m_stop;
+
+  static inline thread_local Pool*    tl_pool  = nullptr;
+  static inline thread_local unsigned tl_index = 0;
+
+  static std::vector<int> parse_cpulist(const std::string& s) {
+    std::vector<int> res;
+    for(size_t pos = 0; pos < s.size(); ) {
+      int a = 0, b = 0, n = 0;
+      const int r = sscanf(s.c_str() + pos, "%d-%d%n", &a, &b, &n);
+      if(r == 2) {
+        for(int i = a; i <= b; ++i) res.push_back(i);
+      } else if(sscanf(s.c_str() + pos, "%d%n", &a, &n) == 1) {
+        res.push_back(a);
+      } else {
+        break;
+      }
+      pos += n + 1; // Skip the comma
+    }
+    return res;
+  }
+
+  // CPUs the process may run on, with their NUMA node
+  static std::vector<std::pair<int, int>> cpus(bool numa) {
+    std::vector<std::pair<int, int>> res; // (node, cpu)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for(int i = 0; i < CPU_SETSIZE; ++i)
+        if(CPU_ISSET(i, &set)) res.emplace_back(0, i);
+    }
+    if(numa) {
+      for(int node = 0; node < 1024; ++node) {
+        std::ifstream is("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if(!is.good()) break;
+        std::string list;
+        std::getline(is, list);
+        for(int cpu : parse_cpulist(list))
+          for(auto& c : res)
+            if(c.second == cpu) c.first = node;
+      }
+      std::sort(res.begin(), res.end());
+    }
+    return res;
+  }
+
+  void signal() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      ++m_epoch;
+    }
+    m_cond.notify_one();
+  }
+
+  // Next task to run by the current thread: from its own deque,
+  // stolen from another worker or from the shared queue.
+  Task* find_task() {
+    const bool own = tl_pool == this;
+    if(own) {
+      if(Task* t = m_workers[tl_index]->deque.pop())
+        return t;
+      for(unsigned v : m_workers[tl_index]->victims)
+        if(Task* t = m_workers[v]->deque.steal())
+          return t;
+    } else {
+      for(auto& w : m_workers)
+        if(Task* t = w->deque.steal())
+          return t;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_injected.empty())
+      return nullptr;
+    Task* t = m_injected.front();
+    m_injected.pop_front();
+    return t;
+  }
+
+  void worker_loop(unsigned i) {
+    tl_pool  = this;
+    tl_index = i;
+    if(m_workers[i]->cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(m_workers[i]->cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    ENUMERABLE_TRACE_THREAD_NAME("worker " + std::to_string(i));
+    while(true) {
+      uint64_t epoch;
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stop) return;
+        epoch = m_epoch;
+      }
+      if(Task* t = find_task()) {
+        t->run(t);
+        continue;
+      }
+      // Sleep until a task is submitted after the search started
+      ENUMERABLE_TRACE_SCOPE("idle");
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [&]() { return m_stop || m_epoch != epoch; });
+    }
+  }
+
+  static pool_options& global_options() {
+    static pool_options opts;
+    return opts;
+  }
+  static std::atomic<bool>& global_started() {
+    static std::atomic<bool> started(false);
+    return started;
+  }
+
+public:
+  explicit Pool(const pool_options& opts = pool_options()) : m_epoch(0), m_stop(false) {
+    const unsigned hw      = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned threads = opts.threads ? opts.threads : hw;
+    const auto     cs      = cpus(opts.numa);
+    for(unsigned i = 0; i + 1 < threads; ++i) {
+      m_workers.emplace_back(new worker);
+      if(!cs.empty()) {
+        const auto& c = cs[i % cs.size()];
+        m_workers[i]->node = c.first;
+        if(opts.affinity) m_workers[i]->cpu = c.second;
+      }
+    }
+    // Steal from the workers of the same node first, starting with
+    // the next worker
+    const unsigned n = m_workers.size();
+    for(unsigned i = 0; i < n; ++i) {
+      auto& victims = m_workers[i]->victims;
+      for(int same = 1; same >= 0; --same)
+        for(unsigned j = 1; j < n; ++j) {
+          const unsigned v = (i + j) % n;
+          if((m_workers[v]->node == m_workers[i]->node) == (bool)same)
+            victims.push_back(v);
+        }
+    }
+    for(unsigned i = 0; i < n; ++i)
+      m_threads.push_back(std::thread(&Pool::worker_loop, this, i));
+  }
+  Pool(const Pool&) = delete;
+  Pool& operator=(const Pool&) = delete;
+  ~Pool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_cond.notify_all();
+    for(auto& th : m_threads)
+      th.join();
+  }
+
+  // Number of threads, the calling thread included
+  unsigned threads() const { return m_workers.size() + 1; }
+  // CPU worker i is pinned to, or -1
+  int cpu(unsigned i) const { return m_workers[i]->cpu; }
+  // True if called from one of the workers
+  bool in_worker() const { return tl_pool == this; }
+
+  // Queue the task t, to be run by one of the threads. On a worker,
+  // it goes to the worker's own deque.
+  void submit(Task* t) {
+    if(tl_pool == this) {
+      m_workers[tl_index]->deque.push(t);
+    } else {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_injected.push_back(t);
+    }
+    signal();
+  }
+
+  // True if the tasks submitted by the calling thread have all been
+  // taken. Used to split work lazily, when other threads are hungry.
+  bool local_empty() {
+    if(tl_pool == this)
+      return m_workers[tl_index]->deque.empty();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_injected.empty();
+  }
+
+  // Run tasks until done() is true
+  template<typename Pred>
+  void help_until(Pred done) {
+    while(!done()) {
+      if(Task* t = find_task())
+        t->run(t);
+      else
+        std::this_thread::yield();
+    }
+  }
+
+  // Pool used by all the parallel operations. It is started on first
+  // use, with the options given to configure_pool.
+  static Pool& global() {
+    global_started() = true;
+    static Pool pool(global_options());
+    return pool;
+  }
+  static void configure(const pool_options& opts) {
+    if(global_started())
+      throw std::logic_error("configure_pool: the thread pool is already started");
+    global_options() = opts;
+  }
+
+  // Call g() k times concurrently, once on the calling thread and k -
+  // 1 times in tasks run by the workers. Return when all the calls
+  // are done. The first exception thrown is rethrown.
+  template<typename G>
+  void run(size_t k, G& g) {
+    k = std::min(k, (size_t)threads());
+    if(k <= 1) {
+      g();
+      return;
+    }
+    struct group {
+      G&                  g;
+      std::atomic<size_t> pending;
+      std::mutex          mtx;
+      std::exception_ptr  error;
+      void call() {
+        try {
+          g();
+        } catch(...) {
+          std::lock_guard<std::mutex> lock(mtx);
+          if(!error) error = std::current_exception();
+        }
+      }
+    } grp { g, { k - 1 }, {}, {} };
+    struct job : Task {
+      group* grp;
+      static void exec(Task* t) {
+        group* grp = static_cast<job*>(t)->grp;
+        grp->call();
+        grp->pending.fetch_sub(1, std::memory_order_release); // grp may be gone after this
+      }
+    };
+    std::vector<job> jobs(k - 1);
+    for(auto& j : jobs) {
+      j.run = &job::exec;
+      j.grp = &grp;
+      submit(&j);
+    }
+    grp.call();
+    help_until([&]() { return grp.pending.load(std::memory_order_acquire) == 0; });
+    if(grp.error)
+      std::rethrow_exception(grp.error);
+  }
+
+  // Run f(i) for all i in [0, n) on up to threads threads, the calling
+  // thread included. Tasks are handed out in increasing order. The
+  // first exception thrown by f cancels the remaining tasks and is
+  // rethrown.
+  template<typename F>
+  void parallel_for(size_t n, unsigned threads, F& f) {
+    std::atomic<size_t> next(0);
+    auto runner = [&]() {
+      for(size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n; ) {
+        try {
+          f(i);
+        } catch(...) {
+          next = n;
+          throw;
+        }
+      }
+    };
+    run(std::min((size_t)threads, n), runner);
+  }
+};
+
+// Run f(i) for all i in [0, n) on up to threads threads of the global
+// pool, the calling thread included. See Pool::parallel_for.
+template<typename F>
+void parallel_for(size_t n, unsigned threads, F f) {
+  if(threads <= 1 || n <= 1) {
+    for(size_t i = 0; i < n; ++i)
+      f(i);
+    return;
+  }
+  Pool::global().parallel_for(n, threads, f);
+}
+
+// Process a splittable enumerable in parallel by chunks, with lazy
+// binary splitting: a task works on its part chunk by chunk, and
+// gives away half of what is left when no other task is queued on its
+// thread, i.e. when other threads are hungry. The grain size is
+// adapted to the measured cost of the chunks, to get chunks of about
+// target_ns nanoseconds, unless set in the policy.
+template<typename Enum, typename Body>
+class ChunkExecutor {
+  static constexpr double target_ns = 50000;
+
+  struct task : Task {
+    ChunkExecutor*  ex;
+    Enum            part;
+    size_t          offset, size;
+    std::thread::id owner;
+    task(ChunkExecutor* e, Enum&& p, size_t o, size_t s)
+      : ex(e), part(std::move(p)), offset(o), size(s), owner(std::this_thread::get_id())
+    { run = &exec; }
+    static void exec(Task* t) {
+      std::unique_ptr<task> self(static_cast<task*>(t));
+      ChunkExecutor* ex = self->ex;
+      if(self->owner != std::this_thread::get_id()) {
+        ex->m_steals.fetch_add(1, std::memory_order_relaxed);
+        ENUMERABLE_TRACE_INSTANT("steal", self->size);
+      }
+      ex->process(self->part, self->offset, self->size);
+      self.reset();
+      ex->m_pending.fetch_sub(1, std::memory_order_release); // ex may be gone after this
+    }
+  };
+
+  Pool&                 m_pool;
+  Body&                 m_body;
+  unsigned              m_threads;
+  size_t                m_max_grain;
+  bool                  m_adaptive;
+  std::atomic<size_t>   m_grain;
+  std::atomic<size_t>   m_pending;
+  std::atomic<unsigned> m_running;
+  std::atomic<size_t>   m_chunks, m_splits, m_steals;
+  std::atomic<bool>     m_cancel;
+  std::mutex            m_mutex;
+  std::exception_ptr    m_error;
+
+  // Update the grain from the time of a chunk. It at most doubles at
+  // each step, to not overshoot on a few cheap elements.
+  void feedback(size_t n, double ns) {
+    const double per  = std::max(ns / n, 0.1);
+    const size_t prev = m_grain.load(std::memory_order_relaxed);
+    const size_t g    = std::max((size_t)1, std::min({ (size_t)(target_ns / per), 2 * prev, m_max_grain }));
+    m_grain.store(g, std::memory_order_relaxed);
+  }
+
+  void process(Enum& e, size_t offset, size_t size) {
+    std::optional<Enum> part(std::move(e));
+    m_running.fetch_add(1, std::memory_order_relaxed);
+    try {
+      while(size > 0 && !m_cancel.load(std::memory_order_relaxed)) {
+        const size_t g = m_grain.load(std::memory_order_relaxed);
+        if(size > 2 * g && m_running.load(std::memory_order_relaxed) < m_threads && m_pool.local_empty()) {
+          const size_t keep  = (size - size / 2 + g - 1) / g * g; // Keep the chunks aligned on the grain
+          const size_t half  = size - keep;
+          Enum         first = part->split(size - half);
+          m_pending.fetch_add(1, std::memory_order_relaxed);
+          m_splits.fetch_add(1, std::memory_order_relaxed);
+          ENUMERABLE_TRACE_INSTANT("split", half);
+          m_pool.submit(new task(this, std::move(*part), offset + size - half, half));
+          part.emplace(std::move(first));
+          size -= half;
+          continue;
+        }
+        const size_t n     = std::min(g, size);
+        Enum         chunk = part->split(n);
+        const auto   start = std::chrono::steady_clock::now();
+        {
+          ENUMERABLE_TRACE_SCOPE_ARG("chunk", n);
+          chunk.start();
+          m_body(chunk, offset);
+        }
+        if(m_adaptive)
+          feedback(n, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+        m_chunks.fetch_add(1, std::memory_order_relaxed);
+        offset += n;
+        size   -= n;
+      }
+    } catch(...) {
+      m_cancel = true;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_error) m_error = std::current_exception();
+    }
+    m_running.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+public:
+  ChunkExecutor(Pool& pool, const par_t& p, Body& body, size_t size)
+    : m_pool(pool), m_body(body)
+    , m_threads(p.threads ? std::min(p.threads, pool.threads()) : pool.threads())
+    , m_max_grain(std::max((size_t)1, size / (4 * m_threads)))
+    , m_adaptive(p.grain == 0)
+    , m_grain(p.grain ? p.grain : 1)
+    , m_pending(0), m_running(0), m_chunks(0), m_splits(0), m_steals(0), m_cancel(false)
+  { }
+
+  void run(Enum& e, const par_t& p) {
+    const size_t size = e.size();
+    if(size == 0 || m_threads <= 1) { // Serial, also to flush a held element
+      e.start();
+      m_body(e, 0);
+      m_chunks = 1;
+    } else {
+      Enum all = e.split(size); // Leaves e empty
+      process(all, 0, size);
+      m_pool.help_until([&]() { return m_pending.load(std::memory_order_acquire) == 0; });
+    }
+    if(p.stats) {
+      p.stats->chunks = m_chunks;
+      p.stats->splits = m_splits;
+      p.stats->steals = m_steals;
+      p.stats->grain  = m_grain;
+    }
+    if(m_error)
+      std::rethrow_exception(m_error);
+  }
+};
+
+// Call body(chunk, offset) on chunks of the splittable enumerable e,
+// in parallel, where offset is the position of the chunk in the
+// source. The chunks are started. See ChunkExecutor. An enumerable
+// which is not splittable (e.g. a zip of a select, whose parts could
+// not be split at the same element) is a single chunk, processed on
+// the calling thread.
+template<typename Enum, typename Body>
+void parallel_chunks(Enum& e, const par_t& p, Body body) {
+  if constexpr(is_splittable<Enum>::value)
+    ChunkExecutor<Enum, Body>(Pool::global(), p, body, e.size()).run(e, p);
+  else
+    body(e, 0);
+}
+
+} // namespace imp
+
+// Set the options of the thread pool shared by all the parallel
+// operations. Must be called before any parallel operation.
+inline void configure_pool(const pool_options& opts) { imp::Pool::configure(opts); }
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_PARALLEL_H__ */
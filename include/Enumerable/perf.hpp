@@ -0,0 +1,190 @@
+#ifndef __ENUMERABLE_PERF_H__
+#define __ENUMERABLE_PERF_H__
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+
+#include <Enumerable.hpp>
+
+// Hardware performance counters around a piece of code, with Linux
+// perf_event_open. The counters are those of the calling thread
+// only. When the counters are not available (other OS, no PMU in a
+// virtual machine, perf_event_paranoid too high), only the time is
+// measured.
+
+namespace Enumerable {
+
+struct perf_counters {
+  enum event { cycles, instructions, cache_references, cache_misses, branches, branch_misses, nb_events };
+  static constexpr const char* names[nb_events] = { "cycles", "instructions", "cache-references", "cache-misses",
+                                                    "branches", "branch-misses" };
+
+  uint64_t elements = 0;         // Elements processed, if known
+  double   seconds  = 0;         // Wall time
+  bool     valid[nb_events] {};  // Whether the counter could be read
+  uint64_t counts[nb_events] {}; // Scaled if the counter was multiplexed
+
+  bool available() const {
+    for(bool v : valid)
+      if(v) return true;
+    return false;
+  }
+  uint64_t operator[](event e) const { return counts[e]; }
+  double ipc() const {
+    return valid[cycles] && valid[instructions] && counts[cycles] ? (double)counts[instructions] / counts[cycles] : 0.0;
+  }
+  double per_element(event e) const { return elements ? (double)counts[e] / elements : 0.0; }
+
+  // One line: time and, when available, IPC and the counters per
+  // element (or in total if the number of elements is unknown).
+  void print(std::ostream& os) const {
+    os << "time " << seconds << " s";
+    if(elements)
+      os << " (" << seconds * 1e9 / elements << " ns/elt)";
+    if(!available()) {
+      os << " [no perf counters]";
+      return;
+    }
+    if(valid[cycles] && valid[instructions])
+      os << " IPC " << ipc();
+    for(int e = 0; e < nb_events; ++e) {
+      if(!valid[e]) continue;
+      os << ' ' << names[e] << ' ';
+      if(elements)
+        os << per_element((event)e) << "/elt";
+      else
+        os << counts[e];
+    }
+  }
+};
+
+namespace imp {
+
+// One counter per event, each its own group so that they are
+// scheduled (and multiplexed) independently.
+class PerfEvents {
+  int m_fds[perf_counters::nb_events];
+
+#ifdef __linux__
+  static int open_event(uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+
+public:
+  PerfEvents() {
+#ifdef __linux__
+    static const uint64_t configs[perf_counters::nb_events] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for(int i = 0; i < perf_counters::nb_events; ++i)
+      m_fds[i] = open_event(configs[i]);
+#else
+    for(int& fd : m_fds)
+      fd = -1;
+#endif
+  }
+  PerfEvents(const PerfEvents&) = delete;
+  PerfEvents& operator=(const PerfEvents&) = delete;
+  ~PerfEvents() {
+    for(int fd : m_fds)
+      if(fd != -1) close(fd);
+  }
+
+  void start() {
+#ifdef __linux__
+    for(int fd : m_fds) {
+      if(fd == -1) continue;
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  void stop(perf_counters& res) {
+#ifdef __linux__
+    for(int fd : m_fds)
+      if(fd != -1) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    for(int i = 0; i < perf_counters::nb_events; ++i) {
+      uint64_t values[3]; // value, time enabled, time running
+      res.valid[i] = m_fds[i] != -1 && read(m_fds[i], values, sizeof(values)) == sizeof(values) && values[2] > 0;
+      res.counts[i] = res.valid[i] ? (uint64_t)((double)values[0] * values[1] / values[2]) : 0;
+    }
+#endif
+  }
+};
+
+// Count the steps, for the per element rates
+template<typename Enum>
+class CountSteps : public Base<CountSteps<Enum>, typename Enum::value_type> {
+  Enum      m_enumerable;
+  uint64_t* m_count;
+public:
+  typedef typename Enum::value_type value_type;
+  CountSteps(Enum e, uint64_t* count) : m_enumerable(e), m_count(count) { }
+  operator bool() const { return m_enumerable; }
+  void operator++() {
+    ++*m_count;
+    ++m_enumerable;
+  }
+  decltype(auto) operator*() const { return *m_enumerable; }
+};
+
+} // namespace imp
+
+// Measure the counters from construction to destruction (or stop())
+// into res.
+class perf_scope {
+  imp::PerfEvents                       m_events;
+  perf_counters&                        m_res;
+  std::chrono::steady_clock::time_point m_start;
+  bool                                  m_running;
+public:
+  explicit perf_scope(perf_counters& res) : m_res(res), m_running(true) {
+    m_events.start();
+    m_start = std::chrono::steady_clock::now();
+  }
+  ~perf_scope() { stop(); }
+  void stop() {
+    if(!m_running) return;
+    m_res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    m_events.stop(m_res);
+    m_running = false;
+  }
+};
+
+// Run the terminal operation op(e) (e.g., [](auto e) { return
+// e.count(); }) under perf_scope and return its result. The elements
+// of e are counted in res.elements.
+template<typename Enum, typename T, typename Op>
+auto profile(perf_counters& res, imp::Base<Enum, T>& e, Op op) {
+  res.elements = 0;
+  imp::CountSteps<Enum> counted(*static_cast<Enum*>(&e), &res.elements);
+  perf_scope scope(res);
+  return op(counted);
+}
+template<typename Enum, typename T, typename Op>
+auto profile(perf_counters& res, imp::Base<Enum, T>&& e, Op op) { return profile(res, e, op); }
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_PERF_H__ */
@@ -0,0 +1,329 @@
+#ifndef __ENUMERABLE_PROBE_H__
+#define __ENUMERABLE_PROBE_H__
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <Enumerable.hpp>
+#include <Enumerable/trace.hpp>
+
+// Probes are stages that count the elements going through them and
+// sample the time spent upstream, e.g.:
+//
+//   lines(is).probe("read").map(parse).probe("parse").select(f).probe("select")
+//
+// The counts are reported by probe_report(). Defining
+// ENUMERABLE_NO_PROBES before including Enumerable.hpp turns probe()
+// into a no-op.
+
+namespace Enumerable {
+
+enum class probe_format { none, text, json };
+
+struct probe_options {
+  unsigned     sample_period = 256;                // Time one step out of sample_period (a power of 2). 0 to disable timing.
+  probe_format at_exit       = probe_format::none; // Report written to stderr at exit
+};
+
+namespace imp {
+
+// Time stamp counter, or nanoseconds if not available
+inline uint64_t probe_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Statistics of all the probes with the same name and upstream probe
+struct ProbeStats {
+  std::string       name;
+  const ProbeStats* parent;  // Upstream probe, if any
+  uint64_t          count;   // Elements gone through
+  uint64_t          ticks;   // Ticks measured upstream
+  uint64_t          samples; // Number of steps timed
+  uint64_t          first, last;
+
+  ProbeStats(const std::string& n, const ProbeStats* p) : name(n), parent(p) { reset(); }
+  void reset() {
+    count = ticks = samples = 0;
+    first = std::numeric_limits<uint64_t>::max();
+    last  = 0;
+  }
+};
+
+class ProbeRegistry {
+  typedef std::chrono::steady_clock clock;
+
+  std::mutex             m_mtx;
+  std::deque<ProbeStats> m_stats; // In registration order, addresses are stable
+  probe_options          m_options;
+  uint64_t               m_ticks0;
+  clock::time_point      m_time0;
+  uint64_t               m_overhead; // Ticks to read the ticks, subtracted from every sample
+
+  ProbeRegistry() : m_ticks0(probe_ticks()), m_time0(clock::now()) {
+    std::vector<uint64_t> overheads(1001);
+    for(auto& o : overheads) {
+      const uint64_t start = probe_ticks();
+      o = probe_ticks() - start;
+    }
+    std::nth_element(overheads.begin(), overheads.begin() + 500, overheads.end());
+    m_overhead = overheads[500]; // Median
+  }
+  ~ProbeRegistry() {
+    if(m_options.at_exit != probe_format::none)
+      report(std::cerr, m_options.at_exit);
+  }
+
+  static uint64_t mask(unsigned period) {
+    if(period == 0) return std::numeric_limits<uint64_t>::max();
+    if(period & (period - 1))
+      throw std::invalid_argument("probe: sample period must be a power of 2");
+    return period - 1;
+  }
+
+public:
+  static ProbeRegistry& global() {
+    static ProbeRegistry registry;
+    return registry;
+  }
+
+  void configure(const probe_options& opts) {
+    mask(opts.sample_period); // Check
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_options = opts;
+  }
+  uint64_t sample_mask() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return mask(m_options.sample_period);
+  }
+
+  // Statistics for name below parent, created if needed
+  ProbeStats* get(const std::string& name, const ProbeStats* parent) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for(auto& s : m_stats)
+      if(s.name == name && s.parent == parent) return &s;
+    m_stats.emplace_back(name, parent);
+    return &m_stats.back();
+  }
+
+  void add(ProbeStats* s, uint64_t count, uint64_t ticks, uint64_t samples, uint64_t first, uint64_t last) {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    s->count   += count;
+    s->ticks   += ticks;
+    s->samples += samples;
+    s->first    = std::min(s->first, first);
+    s->last     = std::max(s->last, last);
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for(auto& s : m_stats)
+      s.reset();
+  }
+
+  // Ticks per second, measured since the creation of the registry
+  double tick_rate() {
+    auto elapsed = clock::now() - m_time0;
+    if(elapsed < std::chrono::milliseconds(10)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+      elapsed = clock::now() - m_time0;
+    }
+    return (probe_ticks() - m_ticks0) / std::chrono::duration<double>(elapsed).count();
+  }
+
+  // For every probe: the number of elements, the estimated time spent
+  // upstream (in total, and in the stages since the upstream probe),
+  // the throughput and the selectivity (elements out / elements out
+  // of the upstream probe).
+  void report(std::ostream& os, probe_format format) {
+    if(format == probe_format::none) return;
+    const double                rate = tick_rate();
+    std::lock_guard<std::mutex> lock(m_mtx);
+    auto upstream = [rate, this](const ProbeStats& s) {
+      const uint64_t overhead = s.samples * m_overhead;
+      return s.samples && s.ticks > overhead ? (double)(s.ticks - overhead) * s.count / s.samples / rate : 0.0;
+    };
+    if(format == probe_format::json) os << "[";
+    bool first = true;
+    for(const auto& s : m_stats) {
+      const double total       = upstream(s);
+      const double self        = s.parent ? std::max(0.0, total - upstream(*s.parent)) : total;
+      const double wall        = s.last > s.first ? (s.last - s.first) / rate : 0.0;
+      const double throughput  = wall > 0 ? s.count / wall : 0.0;
+      const double selectivity = s.parent && s.parent->count ? (double)s.count / s.parent->count : 1.0;
+      if(format == probe_format::json) {
+        os << (first ? "\n" : ",\n") << "  {\"name\": ";
+        write_json_string(os, s.name);
+        os << ", \"upstream\": ";
+        if(s.parent)
+          write_json_string(os, s.parent->name);
+        else
+          os << "null";
+        os << ", \"count\": " << s.count << ", \"time\": " << total << ", \"self_time\": " << self
+           << ", \"throughput\": " << throughput << ", \"selectivity\": " << selectivity << "}";
+      } else {
+        if(first)
+          os << "probe\tcount\ttime(s)\tself(s)\telts/s\tselectivity\n";
+        os << s.name << '\t' << s.count << '\t' << total << '\t' << self << '\t' << throughput << '\t' << selectivity << '\n';
+      }
+      first = false;
+    }
+    if(format == probe_format::json) os << (first ? "]\n" : "\n]\n");
+  }
+};
+
+// Statistics of the probe upstream of e, found going up the stages
+// with an upstream() (Map, Select, etc.), or nullptr. The overloads
+// are ranked: a probe first, then a stage.
+struct probe_rank0 { };
+struct probe_rank1 : probe_rank0 { };
+struct probe_rank2 : probe_rank1 { };
+template<typename Enum>
+ProbeStats* upstream_probe(const Enum&, probe_rank0) { return nullptr; }
+template<typename Enum>
+ProbeStats* upstream_probe(const Probe<Enum>& p, probe_rank2) { return p.stats(); }
+template<typename Enum>
+auto upstream_probe(const Enum& e, probe_rank1) -> decltype((void)e.upstream(), (ProbeStats*)nullptr) {
+  return upstream_probe(e.upstream(), probe_rank2());
+}
+
+// Counts locally, added to the statistics on destruction. Every copy
+// counts the steps it does. It blocks the fusion of the stages around
+// it, so it is best placed between stages doing real work, not
+// between trivial maps.
+template<typename Enum>
+class Probe : public Base<Probe<Enum>, typename Enum::value_type> {
+  // Stages such as Map do their work when dereferenced: on a timed
+  // step, the element is dereferenced and kept for operator*.
+  typedef decltype(*std::declval<const Enum&>()) deref_type;
+  static constexpr bool by_value = !std::is_reference<deref_type>::value;
+  typedef typename std::conditional<by_value, typename std::decay<deref_type>::type, char>::type cached_type;
+
+  Enum        m_enumerable;
+  ProbeStats* m_stats;
+  uint64_t    m_mask;
+  uint64_t    m_count   = 0;
+  uint64_t    m_ticks   = 0;
+  uint64_t    m_samples = 0;
+  uint64_t    m_first;
+  uint64_t    m_rng;
+  uint64_t    m_countdown; // Steps before the next timed one
+  std::optional<cached_type> m_value; // Dereferenced by the last timed step
+
+  // Random interval between timed steps, of mean the sample period,
+  // so that probes in a pipeline do not time the same steps.
+  uint64_t interval() {
+    if(m_mask == std::numeric_limits<uint64_t>::max()) return m_mask;
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 7;
+    m_rng ^= m_rng << 17;
+    return ((m_mask + 1) >> 1) + (m_rng & m_mask) + (m_mask == 0);
+  }
+
+  Probe(Enum e, ProbeStats* s, uint64_t mask)
+    : m_enumerable(e), m_stats(s), m_mask(mask), m_first(probe_ticks())
+    , m_rng((m_first ^ (uintptr_t)this) | 1), m_countdown(interval())
+  { }
+public:
+  typedef typename Enum::value_type value_type;
+
+  Probe(Enum e, const std::string& name)
+    : m_enumerable(e)
+    , m_stats(ProbeRegistry::global().get(name, upstream_probe(e, probe_rank2())))
+    , m_mask(ProbeRegistry::global().sample_mask())
+    , m_first(probe_ticks())
+    , m_rng((m_first ^ (uintptr_t)this) | 1)
+    , m_countdown(interval())
+  { }
+  Probe(const Probe& rhs) : Probe(rhs.m_enumerable, rhs.m_stats, rhs.m_mask) { }
+  Probe& operator=(const Probe& rhs) {
+    flush();
+    m_enumerable = rhs.m_enumerable;
+    m_value.reset();
+    m_stats      = rhs.m_stats;
+    m_mask       = rhs.m_mask;
+    m_first      = probe_ticks();
+    m_countdown  = interval();
+    return *this;
+  }
+  ~Probe() { flush(); }
+
+  ProbeStats* stats() const { return m_stats; }
+
+  void flush() {
+    if(m_count == 0) return;
+    ProbeRegistry::global().add(m_stats, m_count, m_ticks, m_samples, m_first, probe_ticks());
+    m_count = m_ticks = m_samples = 0;
+  }
+
+  operator bool() const { return m_enumerable; }
+  // Count the steps, i.e. the elements consumed.
+  void operator++() {
+    ++m_count;
+    if constexpr(by_value) m_value.reset();
+    if(--m_countdown != 0) {
+      ++m_enumerable;
+      return;
+    }
+    m_countdown = interval();
+    const uint64_t start = probe_ticks();
+    ++m_enumerable;
+    if constexpr(by_value) {
+      if(m_enumerable) m_value.emplace(*m_enumerable);
+    }
+    m_ticks += probe_ticks() - start;
+    ++m_samples;
+  }
+  decltype(auto) operator*() const {
+    if constexpr(by_value) {
+      if(m_value) return deref_type(*m_value);
+    }
+    return *m_enumerable;
+  }
+
+  // Splittable if Enum is
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  size_t size() const { return m_enumerable.size(); }
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  Probe split(size_t n) { return Probe(m_enumerable.split(n), m_stats, m_mask); }
+  static constexpr bool exact_size = has_exact_size<Enum>::value;
+  template<typename E = Enum, typename = typename std::enable_if<is_splittable<E>::value>::type>
+  void start() { m_enumerable.start(); }
+};
+
+} // namespace imp
+
+// Set the sampling period and the report at exit of the probes
+inline void configure_probes(const probe_options& opts) { imp::ProbeRegistry::global().configure(opts); }
+
+// Write the statistics of the probes, as a table or in JSON
+inline void probe_report(std::ostream& os, probe_format format = probe_format::text) {
+  imp::ProbeRegistry::global().report(os, format);
+}
+
+// Zero the statistics. The probes are kept.
+inline void probe_reset() { imp::ProbeRegistry::global().reset(); }
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_PROBE_H__ */
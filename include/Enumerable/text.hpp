@@ -0,0 +1,432 @@
+#ifndef __ENUMERABLE_TEXT_H__
+#define __ENUMERABLE_TEXT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <istream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <Enumerable.hpp>
+#include <Enumerable/io.hpp>
+
+namespace Enumerable {
+namespace imp {
+
+// Bit i of the result is set if p[i] == c, for 64 bytes starting at p
+struct CharMasks {
+  uint64_t sep, quote, nl;
+};
+
+inline CharMasks classify64(const char* p, char sep, char quote, char nl) {
+  CharMasks res;
+#if defined(__SSE2__)
+  const __m128i vs = _mm_set1_epi8(sep), vq = _mm_set1_epi8(quote), vn = _mm_set1_epi8(nl);
+  res.sep = res.quote = res.nl = 0;
+  for(int i = 0; i < 4; ++i) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+    res.sep   |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vs)) << (16 * i);
+    res.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vq)) << (16 * i);
+    res.nl    |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, vn)) << (16 * i);
+  }
+#else
+  res.sep = res.quote = res.nl = 0;
+  for(int i = 0; i < 64; ++i) {
+    res.sep   |= (uint64_t)(p[i] == sep) << i;
+    res.quote |= (uint64_t)(p[i] == quote) << i;
+    res.nl    |= (uint64_t)(p[i] == nl) << i;
+  }
+#endif
+  return res;
+}
+
+// Classify the n < 64 bytes at p, padding with NUL characters
+inline CharMasks classify_tail(const char* p, size_t n, char sep, char quote, char nl) {
+  char buf[64];
+  memcpy(buf, p, n);
+  memset(buf + n, 0, sizeof(buf) - n);
+  CharMasks res = classify64(buf, sep, quote, nl);
+  const uint64_t valid = n ? ~(uint64_t)0 >> (64 - n) : 0;
+  res.sep &= valid; res.quote &= valid; res.nl &= valid;
+  return res;
+}
+
+// Bit i of the result is the XOR of bits 0 to i of x. Applied to the
+// quote mask, it gives the characters inside quotes.
+inline uint64_t prefix_xor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// Scan the separators outside quotes in a structural bit mask. The
+// state (inside quotes or not) carries from one block to the next.
+class StructuralScanner {
+  const char* m_data;
+  size_t      m_size;
+  size_t      m_block;    // Start of the block of m_bits
+  size_t      m_next;     // Start of the next block to classify
+  uint64_t    m_bits;
+  uint64_t    m_inside;   // All ones if the previous block ended inside quotes
+  char        m_sep, m_quote, m_nl;
+
+  bool classify() {
+    if(m_next >= m_size) return false;
+    const size_t    n = std::min((size_t)64, m_size - m_next);
+    const CharMasks m  = n == 64 ? classify64(m_data + m_next, m_sep, m_quote, m_nl)
+      : classify_tail(m_data + m_next, n, m_sep, m_quote, m_nl);
+    const uint64_t inside = prefix_xor(m.quote) ^ m_inside;
+    m_inside              = (uint64_t)0 - (inside >> 63);
+    m_bits                = (m.sep | m.nl) & ~inside;
+    m_block               = m_next;
+    m_next               += 64;
+    return true;
+  }
+
+public:
+  StructuralScanner(const char* data, size_t size, char sep, char quote, char nl)
+    : m_data(data), m_size(size), m_block(0), m_next(0), m_bits(0), m_inside(0)
+    , m_sep(sep), m_quote(quote), m_nl(nl)
+  { }
+
+  // Position of the next separator or newline outside quotes, or size if none
+  size_t next() {
+    while(!m_bits)
+      if(!classify()) return m_size;
+    const size_t res = m_block + __builtin_ctzll(m_bits);
+    m_bits &= m_bits - 1;
+    return res;
+  }
+};
+
+inline std::invalid_argument invalid_number(std::string_view s) {
+  return std::invalid_argument("Invalid number '" + std::string(s) + "'");
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// SWAR parsing of 8 digits, the first digit in the low byte of x
+inline bool is_eight_digits(uint64_t x) {
+  return !(((x + 0x4646464646464646ULL) | (x - 0x3030303030303030ULL)) & 0x8080808080808080ULL);
+}
+inline uint32_t parse_eight_digits(uint64_t x) {
+  const uint64_t mask = 0x000000FF000000FFULL;
+  const uint64_t mul1 = 100 + (1000000ULL << 32);
+  const uint64_t mul2 = 1 + (10000ULL << 32);
+  x -= 0x3030303030303030ULL;
+  x  = (x * 10) + (x >> 8);
+  return (((x & mask) * mul1) + (((x >> 16) & mask) * mul2)) >> 32;
+}
+#endif
+
+// Parse a number, throw std::invalid_argument on error. Integers of
+// up to 18 digits are parsed 8 digits at a time, others (and floating
+// point numbers) with from_chars.
+template<typename T>
+typename std::enable_if<!std::is_integral<T>::value, T>::type parse_number(std::string_view s) {
+  T res {};
+  const char* end = s.data() + s.size();
+  const auto  r   = std::from_chars(s.data(), end, res);
+  if(r.ec != std::errc() || r.ptr != end)
+    throw invalid_number(s);
+  return res;
+}
+
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value, T>::type parse_number(std::string_view s) {
+  const char* p   = s.data();
+  const char* end = p + s.size();
+  const bool  neg = std::is_signed<T>::value && p < end && *p == '-';
+  p += neg;
+  if(p == end || end - p > 18) {
+    T res {};
+    const auto r = std::from_chars(s.data(), end, res);
+    if(r.ec != std::errc() || r.ptr != end)
+      throw invalid_number(s);
+    return res;
+  }
+  uint64_t v = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for( ; end - p >= 8; p += 8) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    if(!is_eight_digits(x))
+      throw invalid_number(s);
+    v = v * 100000000 + parse_eight_digits(x);
+  }
+#endif
+  for( ; p < end; ++p) {
+    const unsigned d = (unsigned char)*p - '0';
+    if(d > 9)
+      throw invalid_number(s);
+    v = v * 10 + d;
+  }
+  const uint64_t max = (uint64_t)std::numeric_limits<T>::max();
+  if(v > max + neg)
+    throw invalid_number(s);
+  return neg ? (T)(0 - v) : (T)v;
+}
+
+// Parse a field, throw std::invalid_argument on error
+template<typename T>
+T parse_field(std::string_view f) { return parse_number<T>(f); }
+template<>
+inline std::string_view parse_field<std::string_view>(std::string_view f) { return f; }
+template<>
+inline std::string parse_field<std::string>(std::string_view f) { return std::string(f); }
+
+// A row of fields: a view of the line and of the offsets of the
+// start of the fields. Valid until the enumerable is advanced (a
+// select stage keeps its source on the selected row). A
+// quoted field is returned without the surrounding quotes, but
+// doubled quotes inside are left as is.
+class Row {
+  std::string_view m_line;
+  const uint32_t*  m_starts; // size() + 1 offsets, the last one being the end of the line + 1
+  size_t           m_size;
+  char             m_quote;
+public:
+  Row() : m_starts(nullptr), m_size(0), m_quote('"') { }
+  Row(std::string_view line, const uint32_t* starts, size_t size, char quote)
+    : m_line(line), m_starts(starts), m_size(size), m_quote(quote) { }
+  size_t size() const { return m_size; }
+  std::string_view line() const { return m_line; }
+  std::string_view operator[](size_t i) const {
+    std::string_view f = m_line.substr(m_starts[i], m_starts[i + 1] - m_starts[i] - 1);
+    if(f.size() >= 2 && f.front() == m_quote && f.back() == m_quote)
+      f = f.substr(1, f.size() - 2);
+    return f;
+  }
+  template<typename T>
+  T get(size_t i) const { return parse_field<T>((*this)[i]); }
+};
+
+// Functor to extract and parse a column, for Map
+template<typename T>
+struct Column {
+  size_t m_i;
+  T operator()(const Row& r) const { return r.template get<T>(m_i); }
+};
+
+// Find the fields of line, in starts
+inline void split_fields(std::string_view line, char sep, char quote, std::vector<uint32_t>& starts) {
+  starts.clear();
+  starts.push_back(0);
+  StructuralScanner scanner(line.data(), line.size(), sep, quote, sep);
+  for(size_t p = scanner.next(); p < line.size(); p = scanner.next())
+    starts.push_back(p + 1);
+  starts.push_back(line.size() + 1);
+}
+
+// Fields of the lines of an enumerable (of std::string or
+// std::string_view). The offsets vector is reused from line to line,
+// so no allocation happens per row.
+template<typename Enum>
+class Fields : public Base<Fields<Enum>, Row> {
+  typedef decltype(*std::declval<const Enum&>()) line_type;
+  // A line returned by value as a string would not outlive operator*:
+  // it is copied in m_buffer.
+  static const bool keep = !std::is_reference<line_type>::value &&
+    !std::is_same<typename std::decay<line_type>::type, std::string_view>::value;
+
+  Enum                  m_enumerable;
+  char                  m_sep, m_quote;
+  std::string           m_buffer;
+  std::string_view      m_line;
+  std::vector<uint32_t> m_starts;
+
+  void split() {
+    if(!m_enumerable) return;
+    auto&& line = *m_enumerable;
+    if(keep) {
+      m_buffer.assign(line.data(), line.size());
+      m_line = m_buffer;
+    } else {
+      m_line = std::string_view(line);
+    }
+    split_fields(m_line, m_sep, m_quote, m_starts);
+  }
+
+public:
+  typedef Row value_type;
+  Fields(Enum e, char sep, char quote = '"') : m_enumerable(e), m_sep(sep), m_quote(quote) { split(); }
+  Fields(const Fields& rhs)
+    : m_enumerable(rhs.m_enumerable), m_sep(rhs.m_sep), m_quote(rhs.m_quote) { split(); }
+  Fields& operator=(const Fields& rhs) {
+    m_enumerable = rhs.m_enumerable;
+    m_sep        = rhs.m_sep;
+    m_quote      = rhs.m_quote;
+    split();
+    return *this;
+  }
+
+  operator bool() const { return m_enumerable; }
+  void operator++() {
+    ++m_enumerable;
+    split();
+  }
+  Row operator*() const { return Row(m_line, m_starts.data(), m_starts.size() - 1, m_quote); }
+  const Enum& upstream() const { return m_enumerable; }
+
+  template<typename T>
+  Map<Fields, Column<T>> column(size_t i) { return this->map(Column<T> { i }); }
+};
+
+// Rows of a CSV file. The file is memory mapped and scanned in one
+// pass, 64 bytes at a time, for separators, quotes and newlines. A
+// quoted field may contain separators and newlines. Copies share the
+// same state.
+class Csv : public Base<Csv, Row> {
+  struct state {
+    MappedFile            file;
+    StructuralScanner     scanner;
+    size_t                row_start = 0;
+    std::string_view      line;
+    std::vector<uint32_t> starts;
+    bool                  has_row = false;
+    char                  sep, quote;
+    state(const std::string& path, char s, char q)
+      : file(path), scanner(file.data(), file.size(), s, q, '\n'), sep(s), quote(q)
+    { file.advise(MADV_SEQUENTIAL); }
+  };
+  std::shared_ptr<state> m_state;
+
+public:
+  typedef Row value_type;
+  Csv(const std::string& path, char sep = ',', char quote = '"')
+    : m_state(std::make_shared<state>(path, sep, quote))
+  { operator++(); }
+
+  operator bool() const { return m_state->has_row; }
+  void operator++() {
+    auto&        s    = *m_state;
+    const char*  data = s.file.data();
+    const size_t size = s.file.size();
+    if(s.row_start >= size) {
+      s.has_row = false;
+      return;
+    }
+    s.starts.clear();
+    s.starts.push_back(0);
+    size_t p = s.scanner.next();
+    for( ; p < size && data[p] == s.sep; p = s.scanner.next())
+      s.starts.push_back(p + 1 - s.row_start);
+    size_t end = p;
+    if(end > s.row_start && data[end - 1] == '\r')
+      --end;
+    s.line = std::string_view(data + s.row_start, end - s.row_start);
+    s.starts.push_back(s.line.size() + 1);
+    s.row_start = p + 1;
+    s.has_row   = true;
+  }
+  Row operator*() const {
+    return Row(m_state->line, m_state->starts.data(), m_state->starts.size() - 1, m_state->quote);
+  }
+
+  template<typename T>
+  Map<Csv, Column<T>> column(size_t i) { return this->map(Column<T> { i }); }
+};
+
+// Numbers separated by white spaces (any character up to ' ') in the
+// chunks returned by Source::next(). The numbers are parsed in place
+// in the chunks; only a number spanning two chunks is copied.
+template<typename T, typename Source>
+class Numbers : public Base<Numbers<T, Source>, T> {
+  struct state {
+    Source      source;
+    const char* pos = nullptr;
+    const char* end = nullptr;
+    std::string carry;
+    T           value {};
+    bool        has_value = false;
+    template<typename... Args>
+    explicit state(Args&&... args) : source(std::forward<Args>(args)...) { }
+    bool fetch() {
+      const std::string_view chunk = source.next();
+      pos = chunk.data();
+      end = chunk.data() + chunk.size();
+      return !chunk.empty();
+    }
+  };
+  std::shared_ptr<state> m_state;
+
+  static bool is_space(char c) { return (unsigned char)c <= ' '; }
+
+public:
+  typedef T value_type;
+  template<typename... Args>
+  explicit Numbers(std::in_place_t, Args&&... args)
+    : m_state(std::make_shared<state>(std::forward<Args>(args)...))
+  { operator++(); }
+
+  operator bool() const { return m_state->has_value; }
+  void operator++() {
+    auto& s = *m_state;
+    while(true) {
+      for( ; s.pos < s.end && is_space(*s.pos); ++s.pos) ;
+      if(s.pos < s.end) break;
+      if(!s.fetch()) {
+        s.has_value = false;
+        return;
+      }
+    }
+    const char* start = s.pos;
+    for( ; s.pos < s.end && !is_space(*s.pos); ++s.pos) ;
+    std::string_view token(start, s.pos - start);
+    if(s.pos == s.end) { // May continue in the next chunk
+      s.carry.assign(start, s.pos);
+      while(s.fetch()) {
+        const char* tstart = s.pos;
+        for( ; s.pos < s.end && !is_space(*s.pos); ++s.pos) ;
+        s.carry.append(tstart, s.pos);
+        if(s.pos < s.end) break;
+      }
+      token = s.carry;
+    }
+    s.value     = parse_number<T>(token);
+    s.has_value = true;
+  }
+  const T& operator*() const { return m_state->value; }
+};
+
+} // namespace imp
+
+// Numbers of type T read from is
+template<typename T>
+imp::Numbers<T, imp::IstreamSource> numbers(std::istream& is) {
+  return imp::Numbers<T, imp::IstreamSource>(std::in_place, is);
+}
+
+// Numbers of type T in the text
+template<typename T>
+imp::Numbers<T, imp::MemorySource> numbers(std::string_view text) {
+  return imp::Numbers<T, imp::MemorySource>(std::in_place, text);
+}
+
+// Numbers of type T in the file path, read ahead asynchronously
+template<typename T>
+imp::Numbers<T, imp::ReadAhead> file_numbers(const std::string& path, const read_options& opts = read_options()) {
+  return imp::Numbers<T, imp::ReadAhead>(std::in_place, path, opts);
+}
+
+inline imp::Csv csv(const std::string& path, char sep = ',', char quote = '"') {
+  return imp::Csv(path, sep, quote);
+}
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_TEXT_H__ */
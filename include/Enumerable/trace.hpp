@@ -0,0 +1,242 @@
+#ifndef __ENUMERABLE_TRACE_H__
+#define __ENUMERABLE_TRACE_H__
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Execution tracer of the parallel operations: chunks, splits,
+// steals, idle workers and waits on the read-ahead queues. Compiled
+// in only if ENUMERABLE_TRACE is defined. The events go to a ring
+// buffer per thread (the oldest events are overwritten) and are
+// written with trace_write() in the Chrome trace format, to load in
+// chrome://tracing or Perfetto.
+//
+// ENUMERABLE_TRACE_SCOPE(name) records the time spent until the end
+// of the scope, ENUMERABLE_TRACE_INSTANT(name, arg) a point event. The
+// names must be string literals.
+
+#define ENUMERABLE_TRACE_CAT2(a, b) a ## b
+#define ENUMERABLE_TRACE_CAT(a, b) ENUMERABLE_TRACE_CAT2(a, b)
+
+#ifdef ENUMERABLE_TRACE
+#define ENUMERABLE_TRACE_SCOPE(name) \
+  ::Enumerable::imp::TraceScope ENUMERABLE_TRACE_CAT(enumerable_trace_, __LINE__)(name, 0)
+#define ENUMERABLE_TRACE_SCOPE_ARG(name, arg) \
+  ::Enumerable::imp::TraceScope ENUMERABLE_TRACE_CAT(enumerable_trace_, __LINE__)(name, arg)
+#define ENUMERABLE_TRACE_INSTANT(name, arg) ::Enumerable::imp::Tracer::record(name, 0, 0, arg)
+#define ENUMERABLE_TRACE_THREAD_NAME(name) ::Enumerable::imp::Tracer::thread_name(name)
+#else
+#define ENUMERABLE_TRACE_SCOPE(name) do { } while(0)
+#define ENUMERABLE_TRACE_SCOPE_ARG(name, arg) do { } while(0)
+#define ENUMERABLE_TRACE_INSTANT(name, arg) do { } while(0)
+#define ENUMERABLE_TRACE_THREAD_NAME(name) do { } while(0)
+#endif
+
+namespace Enumerable {
+namespace imp {
+
+// Write s as a JSON string, quoted and escaped
+inline void write_json_string(std::ostream& os, const std::string& s) {
+  os << '"';
+  for(char c : s) {
+    if(c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+      os << buf;
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+class Tracer {
+  typedef std::chrono::steady_clock clock;
+
+  struct event {
+    const char* name;
+    uint64_t    start;
+    uint64_t    duration; // 0 for a point event
+    uint64_t    arg;
+  };
+
+  // Written by its thread only. Read when writing the trace, which
+  // should happen when the traced operations are done.
+  struct buffer {
+    std::unique_ptr<event[]> events;
+    size_t                   mask;
+    std::atomic<uint64_t>    head;
+    unsigned                 tid;
+    std::string              name;
+    buffer(size_t size, unsigned t) : events(new event[size]), mask(size - 1), head(0), tid(t) { }
+  };
+
+  std::mutex                           m_mutex;
+  std::vector<std::unique_ptr<buffer>> m_buffers;
+  size_t                               m_size;
+  std::string                          m_path; // Written at exit if not empty
+  uint64_t                             m_ticks0;
+  clock::time_point                    m_time0;
+
+  Tracer() : m_size(1 << 16), m_ticks0(ticks()), m_time0(clock::now()) { }
+
+  buffer* attach() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_buffers.emplace_back(new buffer(m_size, m_buffers.size()));
+    return m_buffers.back().get();
+  }
+
+  static buffer* local() {
+    static thread_local buffer* tl_buffer = global().attach();
+    return tl_buffer;
+  }
+
+  static void write_at_exit() {
+    Tracer& t = global();
+    if(!t.m_path.empty())
+      t.write(t.m_path);
+  }
+
+public:
+  // Never destroyed: the worker threads may record events while the
+  // program exits.
+  static Tracer& global() {
+    static Tracer* tracer = new Tracer;
+    return *tracer;
+  }
+
+  static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  static void record(const char* name, uint64_t start, uint64_t duration, uint64_t arg) {
+    buffer*        b = local();
+    const uint64_t h = b->head.load(std::memory_order_relaxed);
+    b->events[h & b->mask] = event { name, start ? start : ticks(), duration, arg };
+    b->head.store(h + 1, std::memory_order_release);
+  }
+
+  static void thread_name(const std::string& name) {
+    buffer*                     b = local();
+    std::lock_guard<std::mutex> lock(global().m_mutex);
+    b->name = name;
+  }
+
+  // Number of events per thread (a power of 2), for the threads not
+  // yet traced, and the file to write at exit.
+  void configure(size_t size, const std::string& path) {
+    if(size == 0 || (size & (size - 1)))
+      throw std::invalid_argument("trace: the buffer size must be a power of 2");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_size = size;
+    if(!path.empty() && m_path.empty())
+      std::atexit(write_at_exit);
+    m_path = path;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto& b : m_buffers)
+      b->head.store(0, std::memory_order_relaxed);
+  }
+
+  void write(std::ostream& os) {
+    auto elapsed = clock::now() - m_time0;
+    const double rate = elapsed.count() > 0 ? (ticks() - m_ticks0) / std::chrono::duration<double>(elapsed).count() : 1e9;
+    auto us = [&](uint64_t t) { return (double)(int64_t)(t - m_ticks0) * 1e6 / rate; };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+    bool first = true;
+    auto sep   = [&]() { os << (first ? "" : ",\n"); first = false; };
+    char buf[256];
+    for(const auto& b : m_buffers) {
+      if(!b->name.empty()) {
+        sep();
+        os << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << b->tid
+           << ", \"args\": {\"name\": ";
+        write_json_string(os, b->name);
+        os << "}}";
+      }
+      const uint64_t head = b->head.load(std::memory_order_acquire);
+      for(uint64_t i = head > b->mask ? head - b->mask - 1 : 0; i < head; ++i) {
+        const event& e = b->events[i & b->mask];
+        sep();
+        if(e.duration)
+          snprintf(buf, sizeof(buf), "{\"ph\": \"X\", \"name\": \"%s\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"n\": %llu}}",
+                   e.name, b->tid, us(e.start), e.duration * 1e6 / rate, (unsigned long long)e.arg);
+        else
+          snprintf(buf, sizeof(buf), "{\"ph\": \"i\", \"s\": \"t\", \"name\": \"%s\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"args\": {\"n\": %llu}}",
+                   e.name, b->tid, us(e.start), (unsigned long long)e.arg);
+        os << buf;
+      }
+    }
+    os << "\n]}\n";
+  }
+  void write(const std::string& path) {
+    std::ofstream os(path);
+    if(!os.good())
+      throw std::runtime_error("trace: can't open '" + path + "'");
+    write(os);
+  }
+};
+
+struct TraceScope {
+  const char* m_name;
+  uint64_t    m_arg;
+  uint64_t    m_start;
+  TraceScope(const char* name, uint64_t arg) : m_name(name), m_arg(arg), m_start(Tracer::ticks()) { }
+  ~TraceScope() { Tracer::record(m_name, m_start, std::max((uint64_t)1, Tracer::ticks() - m_start), m_arg); }
+};
+
+} // namespace imp
+
+// Size of the per thread ring buffers (in events, a power of 2) and
+// file to write the trace to at exit (none if empty). No-op unless
+// ENUMERABLE_TRACE is defined.
+inline void configure_trace([[maybe_unused]] size_t events_per_thread, [[maybe_unused]] const std::string& path = "") {
+#ifdef ENUMERABLE_TRACE
+  imp::Tracer::global().configure(events_per_thread, path);
+#endif
+}
+
+// Write the events recorded so far in the Chrome trace format
+inline void trace_write(const std::string& path) {
+#ifdef ENUMERABLE_TRACE
+  imp::Tracer::global().write(path);
+#else
+  std::ofstream(path) << "{\"traceEvents\": []}\n";
+#endif
+}
+
+// Forget the events recorded so far
+inline void trace_clear() {
+#ifdef ENUMERABLE_TRACE
+  imp::Tracer::global().clear();
+#endif
+}
+
+} // namespace Enumerable
+
+#endif /* __ENUMERABLE_TRACE_H__ */
@@ -0,0 +1,36 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+#include <iostream>
+
+#include <Enumerable/perf.hpp>
+
+// Minimal benchmark harness. Run f (which processes n elements and
+// returns a checksum) a few times and report the best time per
+// element, with the hardware counters of that run when available.
+template<typename F>
+void bench(const char* name, size_t n, F f, int repeat = 5) {
+  Enumerable::perf_counters best;
+  best.seconds = 1e300;
+  decltype(f()) res {};
+  for(int i = 0; i < repeat; ++i) {
+    Enumerable::perf_counters pc;
+    {
+      Enumerable::perf_scope scope(pc);
+      res = f();
+    }
+    if(pc.seconds < best.seconds) best = pc;
+  }
+  best.elements = n;
+  std::printf("%-40s %8.3f ns/elt  (%g)\n", name, best.seconds * 1e9 / n, (double)res);
+  if(best.available()) {
+    std::cout << "  ";
+    best.print(std::cout);
+    std::cout << std::endl;
+  }
+}
+
+#endif /* __BENCH_H__ */
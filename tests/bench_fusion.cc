@@ -0,0 +1,42 @@
+#include <Enumerable.hpp>
+
+#include "bench.hpp"
+
+using namespace Enumerable;
+
+int main() {
+  const long n  = 50000000;
+  auto       f1 = [](long x) { return x * 7 + 1; };
+  auto       p1 = [](long x) { return x % 3 != 0; };
+  auto       f2 = [](long x) { return x ^ (x >> 3); };
+  auto       p2 = [](long x) { return x & 1; };
+  auto       f3 = [](long x) { return x / 2; };
+  auto       add = [](long a, long x) { return a + x; };
+
+  bench("hand fused loop", n, [&]() {
+      long res = 0;
+      for(long i = 0; i < n; ++i) {
+        const long x = f1(i);
+        if(!p1(x)) continue;
+        const long y = f2(x);
+        if(!p2(y)) continue;
+        res += f3(y);
+      }
+      return res;
+    });
+
+  bench("5 stages, fused", n, [&]() {
+      return range(0l, n).map(f1).select(p1).map(f2).select(p2).map(f3).inject(0l, add);
+    });
+
+  bench("5 stages, not fused", n, [&]() {
+      auto s1 = imp::Map<imp::Range<long>, decltype(f1)>(range(0l, n), f1);
+      auto s2 = imp::Select<decltype(s1), decltype(p1)>(s1, p1);
+      auto s3 = imp::Map<decltype(s2), decltype(f2)>(s2, f2);
+      auto s4 = imp::Select<decltype(s3), decltype(p2)>(s3, p2);
+      auto s5 = imp::Map<decltype(s4), decltype(f3)>(s4, f3);
+      return s5.inject(0l, add);
+    });
+
+  return 0;
+}
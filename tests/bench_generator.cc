@@ -0,0 +1,67 @@
+#include <Enumerable/generator.hpp>
+
+#include "bench.hpp"
+
+using namespace Enumerable;
+
+// Hand-written source equivalent to the collatz generator below
+class Collatz : public imp::Base<Collatz, long> {
+  long m_x;
+public:
+  typedef long value_type;
+  explicit Collatz(long x) : m_x(x) { }
+  operator bool() const { return m_x != 1; }
+  void operator++() { m_x = m_x % 2 ? 3 * m_x + 1 : m_x / 2; }
+  long operator*() const { return m_x; }
+};
+
+generator<long> collatz(long x) {
+  for( ; x != 1; x = x % 2 ? 3 * x + 1 : x / 2)
+    co_yield x;
+}
+
+generator<long> collatz_nested(long x, int depth) {
+  if(depth == 0)
+    co_yield collatz(x);
+  else
+    co_yield collatz_nested(x, depth - 1);
+}
+
+int main(int argc, char *argv[]) {
+  const long   start = 837799; // 524 steps
+  const size_t steps = Collatz(start).count();
+  const int    nb    = 20000;
+
+  bench("crtp source", steps * nb, [&]() {
+      long res = 0;
+      for(int i = 0; i < nb; ++i)
+        res += Collatz(start).inject(0l, [](long a, long x) { return a + x; });
+      return res;
+    });
+  bench("generator", steps * nb, [&]() {
+      long res = 0;
+      for(int i = 0; i < nb; ++i)
+        res += collatz(start).inject(0l, [](long a, long x) { return a + x; });
+      return res;
+    });
+  bench("generator nested depth 8", steps * nb, [&]() {
+      long res = 0;
+      for(int i = 0; i < nb; ++i)
+        res += collatz_nested(start, 8).inject(0l, [](long a, long x) { return a + x; });
+      return res;
+    });
+  bench("crtp source, short", 10 * nb, [&]() {
+      long res = 0;
+      for(int i = 0; i < 10 * nb; ++i)
+        res += Collatz(8).count();
+      return res;
+    });
+  bench("generator, short (pooled frames)", 10 * nb, [&]() {
+      long res = 0;
+      for(int i = 0; i < 10 * nb; ++i)
+        res += collatz(8).count();
+      return res;
+    });
+
+  return 0;
+}
@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Enumerable/parallel.hpp>
+
+#include "bench.hpp"
+
+using namespace Enumerable;
+
+int main() {
+  // par(1), par(2) and par(N), N being the number of CPUs. The pool
+  // has at least 2 threads, even on 1 CPU.
+  const unsigned ncpus = std::max(1u, std::thread::hardware_concurrency());
+  configure_pool(pool_options{ std::max(2u, ncpus) });
+  std::vector<unsigned> thread_counts { 1, 2 };
+  if(ncpus > 2) thread_counts.push_back(ncpus);
+
+  const int  n = 10000000;
+  auto       f = [](int i) { return std::sqrt((double)i); };
+  auto       p = [](double x) { return (long)x % 3 != 0; };
+  std::vector<double> res;
+
+  bench("serial map.select.collect", n, [&]() {
+      res.clear();
+      range(0, n).map(f).select(p).collect(res);
+      return res.size();
+    });
+  for(unsigned threads : thread_counts) {
+    const std::string name = "par(" + std::to_string(threads) + ") map.select.collect";
+    bench(name.c_str(), n, [&]() {
+        res.clear();
+        range(0, n).map(f).select(p).collect(par(threads), res);
+        return res.size();
+      });
+    const std::string name2 = "par(" + std::to_string(threads) + ") map.collect";
+    bench(name2.c_str(), n, [&]() {
+        res.clear();
+        range(0, n).map(f).collect(par(threads), res);
+        return res.size();
+      });
+  }
+
+  return 0;
+}
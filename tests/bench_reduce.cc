@@ -0,0 +1,53 @@
+#include <vector>
+
+#include <Enumerable.hpp>
+
+#include "bench.hpp"
+
+using namespace Enumerable;
+
+int main(int argc, char *argv[]) {
+  // Small vectors, in cache, summed many times: not memory bound
+  const size_t        n      = 1 << 12;
+  const int           rounds = 5000;
+  std::vector<double> d(n);
+  std::vector<long>   l(n);
+  for(size_t i = 0; i < n; ++i) {
+    d[i] = 1.0 / (i + 1);
+    l[i] = i * 2654435761u;
+  }
+  auto repeat = [&](auto f) {
+    return [=]() {
+      decltype(f()) res = 0;
+      for(int r = 0; r < rounds; ++r) {
+        asm volatile("" : : : "memory"); // Not hoisted out of the loop
+        res += f();
+      }
+      return res;
+    };
+  };
+
+  bench("long inject", n * rounds, repeat([&]() { return container(l).inject(0l, [](long a, long x) { return a + x; }); }));
+  bench("long sum", n * rounds, repeat([&]() { return container(l).sum(); }));
+  bench("double inject", n * rounds, repeat([&]() { return container(d).inject(0.0, [](double a, double x) { return a + x; }); }));
+  bench("double sum, ordered", n * rounds, repeat([&]() { return container(d).sum(); }));
+  bench("double sum, reassociate", n * rounds, repeat([&]() { return container(d).sum(reduction::reassociate); }));
+  bench("double sum, pairwise", n * rounds, repeat([&]() { return container(d).sum(reduction::pairwise); }));
+  bench("double sum, compensated", n * rounds, repeat([&]() { return container(d).sum(reduction::compensated); }));
+  bench("double sum, reproducible", n * rounds, repeat([&]() { return container(d).sum(reduction::reproducible); }));
+  bench("double product, ordered", n * rounds, repeat([&]() {
+        return container(d).map([](double x) { return 1.0 + x * 1e-9; }).product();
+      }));
+  bench("double product, reassociate", n * rounds, repeat([&]() {
+        return container(d).map([](double x) { return 1.0 + x * 1e-9; }).product(reduction::reassociate);
+      }));
+  bench("long count, min, max: 3 passes", n * rounds, repeat([&]() {
+        return (long)container(l).count() + container(l).min() + container(l).max();
+      }));
+  bench("long count, min, max: fanout", n * rounds, repeat([&]() {
+        auto [c, mn, mx] = container(l).fanout(reducer::count(), reducer::min(), reducer::max());
+        return (long)c + mn + mx;
+      }));
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <Enumerable/bloom.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+TEST(Bloom, NoFalseNegative) {
+  auto bloom = times(10000).to_bloom(1 << 20, 6);
+  EXPECT_TRUE(times(10000).all([&](int x) { return bloom.contains(x); }));
+  EXPECT_EQ((size_t)10000, times(10000).select_in(bloom).count());
+} // Bloom.NoFalseNegative
+
+TEST(Bloom, FalsePositiveRate) {
+  auto bloom = times(10000).to_bloom(1 << 20, 6);
+  const size_t fp = range(10000, 110000).select_in(bloom).count();
+  EXPECT_LT(fp, (size_t)1000);
+} // Bloom.FalsePositiveRate
+
+TEST(Bloom, Parallel) {
+  auto seq = range(0, 100000, 3).to_bloom(1 << 18, 4);
+  auto par = range(0, 100000, 3).to_bloom(1 << 18, 4, 4);
+  EXPECT_TRUE(range(0, 200000).all([&](int x) { return seq.contains(x) == par.contains(x); }));
+} // Bloom.Parallel
+
+TEST(Bloom, SelectIn) {
+  std::istringstream is1("a\nb\nc\n"), is2("c\nd\na\ne\n");
+  auto bloom = lines(is1).to_bloom(1 << 16, 4);
+  std::vector<std::string> v, exp {"c", "a"};
+  lines(is2).select_in(bloom).collect(v);
+  EXPECT_EQ(exp, v);
+} // Bloom.SelectIn
+
+TEST(Bloom, SaveMap) {
+  const char* path = "bloom_save_map.bf";
+  file_unlink unlink(path);
+  std::vector<std::string> words {"hello", "world", "bloom"};
+  {
+    auto bloom = container(words).to_bloom(4096, 5);
+    bloom.save(path);
+  }
+  auto bloom = Bloom<std::string>::map(path);
+  EXPECT_EQ((size_t)4096, bloom.bits());
+  EXPECT_EQ(5u, bloom.hashes());
+  EXPECT_TRUE(container(words).all([&](const std::string& w) { return bloom.contains(w); }));
+  bloom.insert("again");
+  EXPECT_TRUE(bloom.contains("again"));
+  EXPECT_FALSE(Bloom<std::string>::map(path).contains("again"));
+} // Bloom.SaveMap
+
+TEST(Bloom, Merge) {
+  auto b1 = range(0, 100).to_bloom(8192, 4);
+  auto b2 = range(100, 200).to_bloom(8192, 4);
+  b1.merge(b2);
+  EXPECT_EQ((size_t)200, range(0, 200).select_in(b1).count());
+  EXPECT_THROW(b1.merge(range(0, 10).to_bloom(4096, 4)), std::invalid_argument);
+} // Bloom.Merge
+
+} // namespace
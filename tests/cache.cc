@@ -0,0 +1,88 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <Enumerable/cache.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+TEST(Cache, Lines) {
+  std::istringstream is("Hello\nCoucou\n\nA\n");
+  auto c = lines(is).cache();
+  EXPECT_EQ((size_t)4, c.replay().count());
+  EXPECT_TRUE(is.eof()); // Read once
+  EXPECT_EQ("Hello", c.replay().max());
+  std::vector<std::string> v;
+  c.replay().map([](std::string_view l) { return std::string(l); }).collect(v);
+  EXPECT_EQ((std::vector<std::string> { "Hello", "Coucou", "", "A" }), v);
+  EXPECT_EQ((size_t)4, c.cached());
+} // Cache.Lines
+
+TEST(Cache, Lazy) {
+  size_t pulled = 0;
+  auto   c      = range(0, 100).map([&](int x) { ++pulled; return x; }).cache();
+  auto   first  = c.replay();
+  ASSERT_TRUE(first);
+  EXPECT_EQ(0, *first);
+  ++first;
+  ASSERT_TRUE(first);
+  EXPECT_EQ(1, *first);
+  EXPECT_EQ((size_t)2, pulled);
+
+  // Copies at different positions
+  auto second = first;
+  ++second;
+  ASSERT_TRUE(second);
+  EXPECT_EQ(1, *first);
+  EXPECT_EQ(2, *second);
+  EXPECT_EQ(4950, c.replay().sum());
+  EXPECT_EQ(4949, second.sum()); // From 2
+  EXPECT_EQ((size_t)100, pulled);
+  EXPECT_EQ(4950, c.replay().sum());
+  EXPECT_EQ((size_t)100, pulled);
+  EXPECT_EQ((size_t)100, c.cached());
+} // Cache.Lazy
+
+TEST(Cache, Spill) {
+  cache_options opts;
+  opts.chunk_size = 4096;
+  opts.memory     = 8192;
+  auto c = range(0L, 100000L).cache(opts);
+  EXPECT_EQ(4999950000L, c.replay().sum());
+  EXPECT_EQ((size_t)8192, c.memory());
+  EXPECT_LT((size_t)0, c.spilled());
+  EXPECT_TRUE(zip(c.replay(), range(0L)).all([](long x, long i) { return x == i; }));
+} // Cache.Spill
+
+TEST(Cache, Strings) {
+  cache_options opts;
+  opts.chunk_size = 4096;
+  opts.memory     = 4096 * 4;
+  std::vector<std::string> v;
+  for(size_t i = 0; i < 2000; ++i)
+    v.push_back(std::string(i % 37, 'a' + i % 26));
+  v.insert(v.begin() + 1000, std::string(10000, 'z')); // Larger than a chunk
+  auto c = container(v).cache(opts);
+  for(int pass = 0; pass < 2; ++pass) {
+    size_t i = 0;
+    for(auto e = c.replay(); e; ++e, ++i) {
+      ASSERT_LT(i, v.size());
+      EXPECT_EQ(v[i], *e) << i;
+    }
+    EXPECT_EQ(v.size(), i);
+  }
+  EXPECT_LT((size_t)0, c.spilled());
+} // Cache.Strings
+
+TEST(Cache, Objects) {
+  std::vector<std::vector<int>> v { { 1 }, { }, { 2, 3 } };
+  auto c = container(v).cache();
+  EXPECT_EQ((size_t)3, c.replay().count());
+  std::vector<std::vector<int>> res;
+  c.replay().collect(res);
+  EXPECT_EQ(v, res);
+} // Cache.Objects
+
+} // namespace
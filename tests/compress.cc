@@ -0,0 +1,153 @@
+#include <fstream>
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <Enumerable/compress.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+std::string random_lines(size_t nb, size_t max_len) {
+  std::uniform_int_distribution<size_t> len(0, max_len);
+  std::uniform_int_distribution<int>    letter('a', 'z');
+  std::string res;
+  for(size_t i = 0; i < nb; ++i) {
+    for(size_t j = len(rand_gen); j > 0; --j)
+      res += (char)letter(rand_gen);
+    res += '\n';
+  }
+  return res;
+}
+
+void write_file(const char* path, const std::string& content) {
+  std::ofstream os(path);
+  os << content;
+}
+
+std::vector<std::string> getlines(const std::string& content) {
+  std::istringstream is(content);
+  std::vector<std::string> res;
+  lines(is).collect(res);
+  return res;
+}
+
+template<typename Enum>
+std::vector<std::string> strings(Enum e) {
+  std::vector<std::string> res;
+  e.each([&](std::string_view l) { res.emplace_back(l); });
+  return res;
+}
+
+// Deflate data, with a gzip (wbits = 31) or raw (wbits = -15) wrapper
+std::string deflate(const std::string& data, int wbits) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  deflateInit2(&zs, 6, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY);
+  std::string res(deflateBound(&zs, data.size()), '\0');
+  zs.next_in   = (Bytef*)data.data();
+  zs.avail_in  = data.size();
+  zs.next_out  = (Bytef*)&res[0];
+  zs.avail_out = res.size();
+  deflate(&zs, Z_FINISH);
+  res.resize(zs.total_out);
+  deflateEnd(&zs);
+  return res;
+}
+
+void append_le(std::string& s, uint32_t x, int bytes) {
+  for(int i = 0; i < bytes; ++i, x >>= 8)
+    s += (char)(x & 0xff);
+}
+
+// Same format as bgzip: blocks of block bytes of input, and an empty
+// block at the end.
+std::string bgzf(const std::string& data, size_t block = 65280) {
+  std::string res;
+  for(size_t i = 0; i <= data.size(); i += block) {
+    const std::string in = data.substr(i, block);
+    const std::string z  = deflate(in, -15);
+    res += std::string("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+    append_le(res, 18 + z.size() + 8 - 1, 2);
+    res += z;
+    append_le(res, crc32(0, (const Bytef*)in.data(), in.size()), 4);
+    append_le(res, in.size(), 4);
+  }
+  return res;
+}
+
+TEST(LinesCompressed, Plain) {
+  const char* path = "lines_compressed_plain.txt";
+  file_unlink unlink(path);
+  const std::string content = random_lines(10000, 100);
+  write_file(path, content);
+  read_options opts;
+  opts.buffer_size = 4096;
+  auto l = lines_compressed(path, opts);
+  EXPECT_EQ(getlines(content), strings(l));
+} // LinesCompressed.Plain
+
+TEST(LinesCompressed, Gzip) {
+  const char* path = "lines_compressed.gz";
+  file_unlink unlink(path);
+  const std::string content1 = random_lines(10000, 100);
+  const std::string content2 = random_lines(500, 20);
+  write_file(path, deflate(content1, 31) + deflate(content2, 31)); // Concatenated members
+  for(size_t size : { 1000, 1 << 20 }) {
+    read_options opts;
+    opts.buffer_size = size;
+    EXPECT_EQ(getlines(content1 + content2), strings(lines_compressed(path, opts)));
+  }
+  imp::Decompress d(path);
+  EXPECT_EQ(compression::gzip, d.format());
+} // LinesCompressed.Gzip
+
+TEST(LinesCompressed, Bgzf) {
+  const char* path = "lines_compressed.bgz";
+  file_unlink unlink(path);
+  const std::string content = random_lines(50000, 100);
+  write_file(path, bgzf(content));
+  {
+    imp::Decompress d(path);
+    EXPECT_EQ(compression::bgzf, d.format());
+  }
+  for(unsigned threads : { 1, 4 }) {
+    read_options opts;
+    opts.buffer_size = 1 << 18;
+    EXPECT_EQ(getlines(content), strings(lines_compressed(path, opts, '\n', threads)));
+  }
+} // LinesCompressed.Bgzf
+
+TEST(LinesCompressed, Errors) {
+  const char* path = "lines_compressed_errors.gz";
+  file_unlink unlink(path);
+  const std::string content = random_lines(10000, 100);
+  const std::string z = deflate(content, 31);
+  write_file(path, z.substr(0, z.size() / 2));
+  EXPECT_THROW(lines_compressed(path).count(), std::runtime_error);
+
+  const std::string b = bgzf(content);
+  write_file(path, b.substr(0, b.size() - 100));
+  EXPECT_THROW(lines_compressed(path, read_options(), '\n', 2).count(), std::runtime_error);
+
+  std::string c = b;
+  c[c.size() / 2] ^= 0x55;
+  write_file(path, c);
+  EXPECT_THROW(lines_compressed(path, read_options(), '\n', 2).count(), std::runtime_error);
+
+  EXPECT_THROW(lines_compressed("/doesnt/exist.gz"), std::system_error);
+} // LinesCompressed.Errors
+
+TEST(LinesCompressed, EarlyStop) {
+  const char* path = "lines_compressed_stop.gz";
+  file_unlink unlink(path);
+  write_file(path, deflate(random_lines(100000, 100), 31));
+  read_options opts;
+  opts.buffer_size = 4096;
+  opts.depth       = 2;
+  size_t nb = 0;
+  EXPECT_TRUE(lines_compressed(path, opts).any([&](std::string_view) { return ++nb == 10; }));
+  EXPECT_EQ((size_t)10, nb);
+} // LinesCompressed.EarlyStop
+
+} // namespace
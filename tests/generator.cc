@@ -0,0 +1,106 @@
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+#include <Enumerable/generator.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+generator<int> iota(int start, int end) {
+  for(int i = start; i < end; ++i)
+    co_yield i;
+}
+
+generator<int> fib() {
+  int a = 0, b = 1;
+  while(true) {
+    co_yield a;
+    std::tie(a, b) = std::make_tuple(b, a + b);
+  }
+}
+
+generator<int> nested(int depth) {
+  co_yield depth;
+  if(depth > 0) {
+    co_yield nested(depth - 1);
+    co_yield iota(100, 102);
+  }
+  co_yield -depth;
+}
+
+generator<int> deep(int depth) {
+  if(depth == 0) {
+    co_yield iota(0, 3);
+  } else {
+    co_yield deep(depth - 1);
+    co_yield depth;
+  }
+}
+
+generator<std::string> words(std::string s) {
+  std::string word;
+  for(char c : s) {
+    if(c == ' ') {
+      co_yield word;
+      word.clear();
+    } else {
+      word += c;
+    }
+  }
+  if(!word.empty())
+    co_yield word;
+}
+
+generator<int> throws_after(int n) {
+  for(int i = 0; i < n; ++i)
+    co_yield i;
+  throw std::runtime_error("done");
+}
+
+TEST(Generator, Basic) {
+  std::vector<int> v, exp {2, 3, 4, 5};
+  iota(2, 6).collect(v);
+  EXPECT_EQ(exp, v);
+  EXPECT_EQ((size_t)0, iota(0, 0).count());
+} // Generator.Basic
+
+TEST(Generator, Infinite) {
+  std::vector<int> v, exp {0, 1, 1, 2, 3, 5, 8, 13};
+  zip(fib(), times(8)).map([](const std::tuple<int, int>& t) { return std::get<0>(t); }).collect(v);
+  EXPECT_EQ(exp, v);
+} // Generator.Infinite
+
+TEST(Generator, Pipeline) {
+  EXPECT_EQ(20, iota(0, 10).select([](int x) { return x % 2 == 0; }).inject(0, [](int a, int x) { return a + x; }));
+  std::vector<std::string> v, exp {"hello", "big", "world"};
+  words("hello big world").collect(v);
+  EXPECT_EQ(exp, v);
+} // Generator.Pipeline
+
+TEST(Generator, Nested) {
+  std::vector<int> v, exp {2, 1, 0, 0, 100, 101, -1, 100, 101, -2};
+  nested(2).collect(v);
+  EXPECT_EQ(exp, v);
+} // Generator.Nested
+
+TEST(Generator, DeepNested) {
+  std::vector<int> v, exp {0, 1, 2, 1, 2, 3, 4};
+  deep(4).collect(v);
+  EXPECT_EQ(exp, v);
+} // Generator.DeepNested
+
+TEST(Generator, Exception) {
+  auto g = throws_after(3);
+  EXPECT_THROW(g.count(), std::runtime_error);
+  auto g0 = throws_after(0);
+  EXPECT_THROW(g0.count(), std::runtime_error);
+} // Generator.Exception
+
+TEST(Generator, ManyShort) {
+  size_t total = 0;
+  for(int i = 0; i < 100000; ++i)
+    total += iota(0, 3).count();
+  EXPECT_EQ((size_t)300000, total);
+} // Generator.ManyShort
+
+} // namespace
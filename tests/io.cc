@@ -0,0 +1,421 @@
+#include <sys/stat.h>
+
+#include <fstream>
+#include <sstream>
+#include <set>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <Enumerable/io.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+std::string random_lines(size_t nb, size_t max_len) {
+  std::uniform_int_distribution<size_t> len(0, max_len);
+  std::uniform_int_distribution<int>    letter('a', 'z');
+  std::string res;
+  for(size_t i = 0; i < nb; ++i) {
+    for(size_t j = len(rand_gen); j > 0; --j)
+      res += (char)letter(rand_gen);
+    res += '\n';
+  }
+  return res;
+}
+
+void write_file(const char* path, const std::string& content) {
+  std::ofstream os(path);
+  os << content;
+}
+
+std::vector<std::string> getlines(const std::string& content) {
+  std::istringstream is(content);
+  std::vector<std::string> res;
+  lines(is).collect(res);
+  return res;
+}
+
+template<typename Enum>
+std::vector<std::string> strings(Enum e) {
+  std::vector<std::string> res;
+  e.each([&](std::string_view l) { res.emplace_back(l); });
+  return res;
+}
+
+class FileLines : public ::testing::TestWithParam<bool> { };
+
+TEST_P(FileLines, Content) {
+  const char* path = "file_lines_content.txt";
+  file_unlink unlink(path);
+  const std::string contents[] = { "", "\n", "a", "a\nb", "a\nb\n", "\n\nab\n\n", random_lines(1000, 50) };
+  for(const auto& content : contents) {
+    write_file(path, content);
+    for(size_t bs : { 1, 3, 7, 64, 4096 }) {
+      read_options opts;
+      opts.buffer_size = bs;
+      opts.depth       = 3;
+      opts.io_uring    = GetParam();
+      EXPECT_EQ(getlines(content), strings(file_lines(path, opts))) << "buffer_size:" << bs;
+    }
+  }
+} // FileLines.Content
+
+TEST_P(FileLines, Blocks) {
+  const char* path = "file_lines_blocks.txt";
+  file_unlink unlink(path);
+  const std::string content = random_lines(1000, 100);
+  write_file(path, content);
+  read_options opts;
+  opts.buffer_size = 4096;
+  opts.io_uring    = GetParam();
+  std::string res;
+  file_blocks(path, opts).each([&](std::string_view b) { res.append(b); });
+  EXPECT_EQ(content, res);
+  EXPECT_EQ((content.size() + 4095) / 4096, file_blocks(path, opts).count());
+} // FileLines.Blocks
+
+TEST_P(FileLines, Abandon) {
+  const char* path = "file_lines_abandon.txt";
+  file_unlink unlink(path);
+  write_file(path, random_lines(10000, 100));
+  read_options opts;
+  opts.buffer_size = 4096;
+  opts.io_uring    = GetParam();
+  EXPECT_TRUE(file_lines(path, opts).any([](std::string_view) { return true; }));
+} // FileLines.Abandon
+
+// The selected lines are views into buffers released when the
+// source is advanced
+TEST_P(FileLines, Select) {
+  const char* path = "file_lines_select.txt";
+  file_unlink unlink(path);
+  const std::string content = random_lines(2000, 50);
+  write_file(path, content);
+  auto small = [](std::string_view l) { return !l.empty() && l[0] < 'm'; };
+  std::vector<std::string> exp;
+  for(const auto& l : getlines(content))
+    if(small(l)) exp.push_back(l);
+  read_options opts;
+  opts.buffer_size = 64;
+  opts.depth       = 2;
+  opts.io_uring    = GetParam();
+  EXPECT_EQ(exp, strings(file_lines(path, opts).select(small)));
+  EXPECT_EQ(exp, strings(file_lines(path, opts).select(small).select([](std::string_view l) { return l.size() < 100; })));
+  EXPECT_EQ(exp, strings(file_lines(path, opts).filter_map([&](std::string_view l) {
+          return small(l) ? std::optional<std::string_view>(l) : std::nullopt; })));
+
+  const auto res = file_lines(path, opts).fanout(reducer::max(), reducer::min());
+  const auto all = getlines(content);
+  EXPECT_EQ(*std::max_element(all.begin(), all.end()), std::get<0>(res));
+  EXPECT_EQ(*std::min_element(all.begin(), all.end()), std::get<1>(res));
+} // FileLines.Select
+
+INSTANTIATE_TEST_CASE_P(FileLines, FileLines, ::testing::Values(true, false));
+
+TEST(FileLines, Delimiter) {
+  const char* path = "file_lines_delim.txt";
+  file_unlink unlink(path);
+  write_file(path, "a,bc,,d");
+  std::vector<std::string> exp {"a", "bc", "", "d"};
+  EXPECT_EQ(exp, strings(file_lines(path, read_options(), ',')));
+} // FileLines.Delimiter
+
+TEST(FileLines, NoFile) {
+  EXPECT_THROW(file_lines("/non/existent/file"), std::system_error);
+} // FileLines.NoFile
+
+TEST(ParLines, Ranges) {
+  const char* path = "par_lines_ranges.txt";
+  file_unlink unlink(path);
+  const std::string content = random_lines(20000, 60);
+  write_file(path, content);
+  const auto expected = getlines(content);
+
+  for(size_t ranges : { 1, 2, 7, 100 }) {
+    auto pl = par_lines(path, 4, ranges);
+    EXPECT_LE(pl.ranges(), ranges);
+    auto counts = pl.map_ranges([](auto ls) { return ls.count(); });
+    size_t total = 0;
+    for(auto c : counts) total += c;
+    EXPECT_EQ(expected.size(), total);
+
+    std::vector<std::string> v;
+    pl.collect([](auto ls) { return ls.map([](std::string_view l) { return std::string(l); }); }, v);
+    EXPECT_EQ(expected, v);
+
+    std::vector<std::string> u;
+    pl.collect([](auto ls) { return ls.map([](std::string_view l) { return std::string(l); }); }, u, false);
+    EXPECT_EQ(expected.size(), u.size());
+  }
+} // ParLines.Ranges
+
+TEST(ParLines, Inject) {
+  const char* path = "par_lines_inject.txt";
+  file_unlink unlink(path);
+  const std::string content = random_lines(20000, 60);
+  write_file(path, content);
+
+  auto pl = par_lines(path, 3);
+  const size_t chars = pl.inject((size_t)0, [](size_t a, std::string_view l) { return a + l.size() + 1; },
+                                 [](size_t a, size_t b) { return a + b; });
+  EXPECT_EQ(content.size(), chars);
+  const std::string all = pl.inject(std::string(), [](std::string a, std::string_view l) { return a.append(l).append("\n"); },
+                                    [](std::string a, const std::string& b) { return a + b; });
+  EXPECT_EQ(content, all);
+
+  std::atomic<size_t> nb(0);
+  pl.each([&](std::string_view) { ++nb; });
+  EXPECT_EQ((size_t)20000, nb.load());
+} // ParLines.Inject
+
+TEST(ParLines, Empty) {
+  const char* path = "par_lines_empty.txt";
+  file_unlink unlink(path);
+  write_file(path, "");
+  EXPECT_EQ((size_t)0, par_lines(path, 2).inject((size_t)0, [](size_t a, std::string_view) { return a + 1; },
+                                                 [](size_t a, size_t b) { return a + b; }));
+} // ParLines.Empty
+
+struct Point {
+  int    x, y;
+  double w;
+};
+
+TEST(Records, WriteRead) {
+  const char* path = "records_write_read.bin";
+  file_unlink unlink(path);
+  for(bool direct : { false, true }) {
+    write_options opts;
+    opts.buffer_size = 8192;
+    opts.direct      = direct;
+    const int n = 10001; // Not a multiple of the buffer size
+    EXPECT_EQ((size_t)n, times(n).map([](int i) { return Point { i, -i, 0.5 * i }; }).write_records(path, opts));
+
+    struct stat st;
+    ASSERT_EQ(0, stat(path, &st));
+    EXPECT_EQ((off_t)(n * sizeof(Point)), st.st_size);
+    EXPECT_EQ((size_t)n, records<Point>(path).count());
+    int i = 0;
+    EXPECT_TRUE(records<Point>(path).all([&](const Point& p) {
+          const bool res = p.x == i && p.y == -i && p.w == 0.5 * i;
+          ++i;
+          return res;
+        }));
+    EXPECT_EQ(n - 1, records<Point>(path).map([](const Point& p) { return p.x; }).max());
+  }
+} // Records.WriteRead
+
+TEST(Records, Empty) {
+  const char* path = "records_empty.bin";
+  file_unlink unlink(path);
+  EXPECT_EQ((size_t)0, times(0).write_records(path));
+  EXPECT_EQ((size_t)0, records<int>(path).count());
+} // Records.Empty
+
+TEST(Records, Truncated) {
+  const char* path = "records_truncated.bin";
+  file_unlink unlink(path);
+  write_file(path, "abcde");
+  EXPECT_THROW(records<int>(path), std::runtime_error);
+  EXPECT_EQ((size_t)5, records<char>(path).count());
+} // Records.Truncated
+
+std::string read_file(const char* path) {
+  std::ifstream is(path);
+  std::ostringstream os;
+  os << is.rdbuf();
+  return os.str();
+}
+
+TEST(WriteLines, Print) {
+  std::ostringstream os;
+  EXPECT_EQ((size_t)4, range(-2, 2).print(os));
+  EXPECT_EQ("-2\n-1\n0\n1\n", os.str());
+
+  std::ostringstream os2;
+  container(std::vector<double>{0.5, 1e20, -3}).print(os2);
+  EXPECT_EQ("0.5\n1e+20\n-3\n", os2.str());
+
+  std::ostringstream os3;
+  std::istringstream is("a\nbc\n");
+  zip(lines(is), range(1, 10), range(0.5, 10.0)).print(os3);
+  EXPECT_EQ("a\t1\t0.5\nbc\t2\t1.5\n", os3.str());
+
+  std::ostringstream os4;
+  std::vector<bool> bs {true, false};
+  container(bs).map([](bool b) { return b; }).print(os4);
+  container(std::string("xy")).print(os4);
+  EXPECT_EQ("1\n0\nx\ny\n", os4.str());
+} // WriteLines.Print
+
+struct Counted { int x; };
+int counted_calls = 0;
+std::ostream& operator<<(std::ostream& os, const Counted& c) {
+  ++counted_calls;
+  return os << '<' << c.x << '>';
+}
+
+TEST(WriteLines, Format) {
+  // Through operator<<, once per element
+  std::vector<Counted> v { {1}, {22}, {3} };
+  std::ostringstream os;
+  counted_calls = 0;
+  container(v).print(os);
+  EXPECT_EQ("<1>\n<22>\n<3>\n", os.str());
+  EXPECT_EQ(3, counted_calls);
+  std::ostringstream os2;
+  zip(container(v), container(v).map([](const Counted& c) { return Counted { c.x + 1 }; })).print(os2);
+  EXPECT_EQ("<1>\t<2>\n<22>\t<23>\n<3>\t<4>\n", os2.str());
+
+  // Characters, not numbers
+  std::ostringstream os3;
+  std::vector<signed char> sc { 'a', 'b' };
+  std::vector<unsigned char> uc { 'c', 'd' };
+  container(sc).print(os3);
+  container(uc).print(os3);
+  zip(container(sc), range(1, 3)).print(os3);
+  EXPECT_EQ("a\nb\nc\nd\na\t1\nb\t2\n", os3.str());
+} // WriteLines.Format
+
+TEST(WriteLines, SmallBuffer) {
+  std::ostringstream os, exp;
+  const std::string big(200, 'x');
+  std::vector<std::string> v { "a", big, "bb", big + big, "" };
+  for(const auto& s : v)
+    exp << s << '\n';
+  EXPECT_EQ((size_t)5, container(v).print(os, 64));
+  EXPECT_EQ(exp.str(), os.str());
+} // WriteLines.SmallBuffer
+
+TEST(WriteLines, File) {
+  const char* path = "write_lines_file.txt";
+  file_unlink unlink(path);
+  std::ostringstream exp;
+  for(int i = 0; i < 100000; ++i)
+    exp << i * 3 << '\n';
+  EXPECT_EQ((size_t)100000, times(100000).map([](int i) { return i * 3; }).write_lines(path));
+  EXPECT_EQ(exp.str(), read_file(path));
+
+  const int fd = open(path, O_WRONLY | O_TRUNC);
+  ASSERT_NE(-1, fd);
+  EXPECT_EQ((size_t)100000, times(100000).map([](int i) { return i * 3; }).write_lines(fd, 4096));
+  close(fd);
+  EXPECT_EQ(exp.str(), read_file(path));
+} // WriteLines.File
+
+// Tree of directories and files removed on destruction
+struct tmp_tree {
+  std::vector<std::string> paths;
+  std::string dir(const std::string& p) {
+    mkdir(p.c_str(), 0755);
+    paths.push_back(p);
+    return p;
+  }
+  std::string file(const std::string& p, const std::string& content) {
+    write_file(p.c_str(), content);
+    paths.push_back(p);
+    return p;
+  }
+  std::string link(const std::string& target, const std::string& p) {
+    EXPECT_EQ(0, symlink(target.c_str(), p.c_str()));
+    paths.push_back(p);
+    return p;
+  }
+  ~tmp_tree() {
+    for(auto it = paths.rbegin(); it != paths.rend(); ++it)
+      remove(it->c_str());
+  }
+};
+
+TEST(Files, Walk) {
+  tmp_tree t;
+  const std::string top = t.dir("files_walk");
+  t.dir(top + "/a");
+  t.dir(top + "/a/b");
+  t.dir(top + "/c");
+  std::set<std::string> txt, all;
+  for(const auto& p : { "/x.txt", "/a/y.txt", "/a/b/z.txt", "/a/b/w.dat", "/c/v.txt" }) {
+    all.insert(t.file(top + p, p));
+    if(std::string(p).find(".txt") != std::string::npos)
+      txt.insert(top + p);
+  }
+  t.file(top + "/a/.hidden.txt", "hidden");
+  all.insert(t.link("x.txt", top + "/link.txt"));
+  txt.insert(top + "/link.txt");
+  t.link("a", top + "/linkdir"); // Not followed
+  t.link("nothing", top + "/dangling.txt");
+
+  std::set<std::string> res;
+  files(top, "*.txt").each([&](const std::string& p) { res.insert(p); });
+  EXPECT_EQ(txt, res);
+  res.clear();
+  files(top + "/").each([&](const std::string& p) { res.insert(p); });
+  EXPECT_EQ(all, res);
+  EXPECT_EQ((size_t)1, files(top + "/a", ".*").count());
+  EXPECT_EQ((size_t)2, files(top, "*", false).count()); // x.txt and link.txt, not the dangling link
+  EXPECT_THROW(files(top + "/doesnt_exist"), std::system_error);
+} // Files.Walk
+
+// Type of the entries on file systems which don't return it
+TEST(Files, UnknownType) {
+  tmp_tree t;
+  const std::string top = t.dir("files_unknown");
+  t.dir(top + "/d");
+  t.file(top + "/f", "f");
+  t.link("f", top + "/lf");
+  t.link("d", top + "/ld");
+  t.link("nothing", top + "/dangling");
+  const int fd = open(top.c_str(), O_RDONLY | O_DIRECTORY);
+  ASSERT_NE(-1, fd);
+  EXPECT_EQ(DT_DIR, imp::Files::entry_type(fd, "d", DT_UNKNOWN));
+  EXPECT_EQ(DT_REG, imp::Files::entry_type(fd, "f", DT_UNKNOWN));
+  EXPECT_EQ(DT_REG, imp::Files::entry_type(fd, "lf", DT_UNKNOWN));
+  EXPECT_EQ(DT_REG, imp::Files::entry_type(fd, "lf", DT_LNK));
+  EXPECT_EQ(DT_UNKNOWN, imp::Files::entry_type(fd, "ld", DT_UNKNOWN)); // Not followed
+  EXPECT_EQ(DT_UNKNOWN, imp::Files::entry_type(fd, "ld", DT_LNK));
+  EXPECT_EQ(DT_UNKNOWN, imp::Files::entry_type(fd, "dangling", DT_UNKNOWN));
+  EXPECT_EQ(DT_UNKNOWN, imp::Files::entry_type(fd, "removed", DT_UNKNOWN));
+  close(fd);
+} // Files.UnknownType
+
+TEST(Files, Many) {
+  tmp_tree t;
+  const std::string top = t.dir("files_many");
+  std::string all;
+  for(int i = 0; i < 20; ++i) {
+    const std::string sub = t.dir(top + "/d" + std::to_string(i));
+    for(int j = 0; j < 20; ++j) {
+      const std::string content = random_lines(20, 30);
+      all += content;
+      t.file(sub + "/f" + std::to_string(j), content);
+    }
+  }
+  EXPECT_EQ((size_t)400, files(top).count());
+
+  auto pf = par_files(files(top), 4, 64);
+  EXPECT_EQ((size_t)400, pf.ranges());
+  const size_t chars = pf.inject((size_t)0, [](size_t a, std::string_view l) { return a + l.size() + 1; },
+                                 [](size_t a, size_t b) { return a + b; });
+  EXPECT_EQ(all.size(), chars);
+
+  // Same lines, in the order of the files
+  std::vector<std::string> expected, res;
+  for(size_t i = 0; i < pf.ranges(); ++i) {
+    std::ifstream is(pf.path(i));
+    lines(is).collect(expected);
+  }
+  pf.collect([](auto ls) { return ls.map([](std::string_view l) { return std::string(l); }); }, res);
+  EXPECT_EQ(expected, res);
+
+  std::atomic<size_t> nb(0);
+  pf.each([&](std::string_view) { ++nb; });
+  EXPECT_EQ((size_t)400 * 20, nb.load());
+
+  // Concatenation of the files, opened two ahead
+  std::vector<std::string> cat_res;
+  cat_all(files(top).map([](const std::string& p) { return file_lines(p); }), 3)
+    .each([&](std::string_view l) { cat_res.emplace_back(l); });
+  EXPECT_EQ(expected, cat_res);
+} // Files.Many
+
+} // namespace
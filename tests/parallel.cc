@@ -0,0 +1,310 @@
+#include <cmath>
+#include <set>
+#include <mutex>
+#include <numeric>
+#include <list>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <Enumerable/parallel.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+// Run the tests with several threads, whatever the number of CPUs
+const bool pool_configured = (configure_pool(pool_options{ 4 }), true);
+
+TEST(WorkDeque, Owner) {
+  imp::WorkDeque d(4);
+  std::vector<imp::Task> tasks(100);
+  EXPECT_TRUE(d.empty());
+  EXPECT_EQ(nullptr, d.pop());
+  for(auto& t : tasks)
+    d.push(&t); // Grows
+  EXPECT_EQ(&tasks[0], d.steal()); // FIFO from the top
+  for(size_t i = tasks.size() - 1; i > 0; --i)
+    EXPECT_EQ(&tasks[i], d.pop()); // LIFO from the bottom
+  EXPECT_EQ(nullptr, d.pop());
+  EXPECT_EQ(nullptr, d.steal());
+} // WorkDeque.Owner
+
+TEST(WorkDeque, Steal) {
+  const size_t        n = 200000;
+  imp::WorkDeque      d;
+  std::vector<imp::Task> tasks(n);
+  std::atomic<bool>   done(false);
+  std::vector<int>    seen(n, 0);
+  auto record = [&](imp::Task* t) { ++seen[t - tasks.data()]; };
+
+  std::vector<std::thread> thieves;
+  std::vector<std::vector<imp::Task*>> stolen(3);
+  for(auto& s : stolen)
+    thieves.push_back(std::thread([&]() {
+          while(!done || !d.empty())
+            if(imp::Task* t = d.steal()) s.push_back(t);
+        }));
+  for(size_t i = 0; i < n; ++i) {
+    d.push(&tasks[i]);
+    if(i % 3 == 0)
+      if(imp::Task* t = d.pop()) record(t);
+  }
+  while(imp::Task* t = d.pop())
+    record(t);
+  done = true;
+  for(auto& th : thieves)
+    th.join();
+  for(auto& s : stolen)
+    for(auto t : s)
+      record(t);
+  for(size_t i = 0; i < n; ++i)
+    EXPECT_EQ(1, seen[i]) << i;
+} // WorkDeque.Steal
+
+TEST(Pool, ParallelFor) {
+  imp::Pool pool(pool_options{ 4 });
+  EXPECT_EQ(4u, pool.threads());
+  std::vector<std::atomic<int>> counts(10000);
+  auto f = [&](size_t i) { ++counts[i]; };
+  pool.parallel_for(counts.size(), 4, f);
+  for(auto& c : counts)
+    EXPECT_EQ(1, c.load());
+
+  auto g = [&](size_t i) { if(i == 500) throw std::runtime_error("500"); };
+  EXPECT_THROW(pool.parallel_for(1000, 4, g), std::runtime_error);
+  size_t zero = 0;
+  auto h = [&](size_t) { ++zero; };
+  pool.parallel_for(0, 4, h);
+  EXPECT_EQ((size_t)0, zero);
+} // Pool.ParallelFor
+
+TEST(Pool, Nested) {
+  // A parallel loop inside a parallel loop runs on the same threads
+  imp::Pool pool(pool_options{ 3 });
+  std::mutex mtx;
+  std::set<std::thread::id> ids;
+  std::atomic<size_t> total(0);
+  auto inner = [&](size_t) {
+    ++total;
+    std::lock_guard<std::mutex> lock(mtx);
+    ids.insert(std::this_thread::get_id());
+  };
+  auto outer = [&](size_t) { pool.parallel_for(100, 3, inner); };
+  pool.parallel_for(20, 3, outer);
+  EXPECT_EQ((size_t)2000, total.load());
+  EXPECT_LE(ids.size(), (size_t)3);
+} // Pool.Nested
+
+TEST(Pool, Affinity) {
+  pool_options opts;
+  opts.threads  = 3;
+  opts.affinity = true;
+  opts.numa     = true;
+  imp::Pool pool(opts);
+  EXPECT_LE(0, pool.cpu(0));
+  EXPECT_LE(0, pool.cpu(1));
+  std::atomic<size_t> sum(0);
+  auto f = [&](size_t i) { sum += i; };
+  pool.parallel_for(1000, 3, f);
+  EXPECT_EQ((size_t)999 * 1000 / 2, sum.load());
+} // Pool.Affinity
+
+TEST(Pool, Global) {
+  std::vector<size_t> res(1000);
+  imp::parallel_for(res.size(), 8, [&](size_t i) { res[i] = i * i; });
+  for(size_t i = 0; i < res.size(); ++i)
+    EXPECT_EQ(i * i, res[i]);
+  EXPECT_TRUE(imp::Pool::global().threads() >= 1);
+  EXPECT_THROW(configure_pool(pool_options()), std::logic_error);
+} // Pool.Global
+
+TEST(Splittable, Split) {
+  static_assert(imp::is_splittable<imp::Range<int>>::value, "Range");
+  static_assert(!imp::is_splittable<imp::IstreamLines>::value, "IstreamLines");
+  auto r = range(0, 10, 3);
+  EXPECT_EQ((size_t)4, r.size());
+  auto r1 = r.split(3);
+  EXPECT_EQ((size_t)3, r1.size());
+  EXPECT_EQ(9, r.max());
+  EXPECT_EQ(6, r1.max());
+
+  std::vector<int> v { 1, 2, 3, 4, 5 };
+  auto c  = container(v).select([](int x) { return x % 2 == 0; });
+  EXPECT_EQ((size_t)3, c.size()); // 2 is held
+  auto c1 = c.split(1);           // 2 and 3
+  c1.start();
+  EXPECT_EQ((size_t)1, c1.count());
+  c.start();
+  EXPECT_EQ(4, *c);
+
+  std::list<int> l(v.begin(), v.end());
+  static_assert(!imp::is_splittable<decltype(container(l))>::value, "list");
+  auto z = zip(range(0, 5), container(v)).map([](std::tuple<int, int>) { return 0; });
+  static_assert(imp::is_splittable<decltype(z)>::value, "zip");
+} // Splittable.Split
+
+TEST(ParEach, Range) {
+  const size_t n = 100000;
+  std::vector<std::atomic<int>> counts(n);
+  par_stats stats;
+  auto r = range((size_t)0, n);
+  r.each(par(4, 0, &stats), [&](size_t i) { ++counts[i]; });
+  EXPECT_FALSE(r);
+  for(auto& c : counts)
+    EXPECT_EQ(1, c.load());
+  EXPECT_LE((size_t)1, stats.chunks);
+  EXPECT_LE((size_t)1, stats.grain);
+
+  // Fixed grain
+  std::atomic<size_t> sum(0);
+  range((size_t)0, n).each(par(4, 1000, &stats), [&](size_t i) { sum += i; });
+  EXPECT_EQ(n * (n - 1) / 2, sum.load());
+  EXPECT_EQ((size_t)100, stats.chunks);
+  EXPECT_EQ((size_t)1000, stats.grain);
+} // ParEach.Range
+
+TEST(ParEach, Skewed) {
+  // Expensive elements are all at the end
+  const int n = 20000;
+  std::atomic<long> sum(0);
+  range(0, n).select([](int i) {
+      if(i < n - 100) return i % 7 == 0;
+      volatile int x = 0;
+      for(int j = 0; j < 10000; ++j) x = x + j;
+      return true;
+    }).each(par, [&](int i) { sum += i; });
+  long expected = 0;
+  for(int i = 0; i < n; ++i)
+    if(i >= n - 100 || i % 7 == 0) expected += i;
+  EXPECT_EQ(expected, sum.load());
+} // ParEach.Skewed
+
+TEST(ParInject, Ordered) {
+  // Concatenation is associative but not commutative
+  std::vector<int> v(5000);
+  std::iota(v.begin(), v.end(), 0);
+  auto res = container(v).map([](int x) { return std::to_string(x) + ","; })
+    .inject(par(3, 7), std::string(), [](std::string a, std::string x) { return a + x; },
+            [](std::string a, std::string b) { return a + b; });
+  std::string expected;
+  for(int x : v)
+    expected += std::to_string(x) + ",";
+  EXPECT_EQ(expected, res);
+
+  const size_t odds = zip(range(0, 1000), range(1000, 2000))
+    .select([](std::tuple<int, int> t) { return std::get<0>(t) % 2; })
+    .inject(par, (size_t)0, [](size_t a, int, int) { return a + 1; }, [](size_t a, size_t b) { return a + b; });
+  EXPECT_EQ((size_t)500, odds);
+
+  EXPECT_THROW(range(0, 1000).each(par, [](int i) { if(i == 10) throw std::runtime_error("10"); }), std::runtime_error);
+} // ParInject.Ordered
+
+TEST(ParCollect, Sized) {
+  static_assert(imp::has_exact_size<imp::Range<int>>::value, "Range");
+  const int n = 100000;
+  std::vector<long> res { -1 };
+  range(0, n).map([](int i) { return (long)i * i; }).collect(par, res);
+  ASSERT_EQ((size_t)n + 1, res.size());
+  EXPECT_EQ(-1, res[0]);
+  for(int i = 0; i < n; ++i)
+    EXPECT_EQ((long)i * i, res[i + 1]);
+
+  std::vector<std::string> v { "a", "b", "c" }, strs;
+  container(v).collect(par, strs);
+  EXPECT_EQ(v, strs);
+} // ParCollect.Sized
+
+TEST(ParCollect, Unsized) {
+  const int n = 100000;
+  auto pipeline = [&]() { return range(0, n).map([](int i) { return i * 3; }).select([](int x) { return x % 7 < 3; }); };
+  static_assert(!imp::has_exact_size<decltype(pipeline())>::value, "Select");
+  std::vector<int> expected, res;
+  pipeline().collect(expected);
+  for(auto p : { par, par(2), par(4, 10) }) {
+    res.clear();
+    pipeline().collect(p, res);
+    EXPECT_EQ(expected, res);
+  }
+  res.assign({ -1, -2 });
+  pipeline().collect(par(4, 100), res);
+  ASSERT_EQ(expected.size() + 2, res.size());
+  EXPECT_EQ(-2, res[1]);
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), res.begin() + 2));
+  res.clear();
+  range(0, n).select([](int) { return false; }).collect(par, res);
+  EXPECT_TRUE(res.empty());
+
+  // A zip of a select is not split: its chunks would not be aligned
+  auto even = [](int x) { return x % 2 == 0; };
+  auto zipped = [&]() { return zip(range(0, 200000).select(even), range(0, 200000)); };
+  static_assert(!imp::is_splittable<decltype(zipped())>::value, "Zip");
+  std::vector<std::tuple<int, int>> zexp, zres;
+  zipped().collect(zexp);
+  zipped().collect(par(4, 1000), zres);
+  ASSERT_EQ((size_t)100000, zres.size());
+  EXPECT_EQ(zexp, zres);
+  EXPECT_EQ(std::make_tuple(199998, 99999), zres.back());
+} // ParCollect.Unsized
+
+TEST(ParCollect, Nested) {
+  // The predicate runs a parallel operation: a thread waiting for it
+  // may process another chunk of the outer collect.
+  const int n = 4000;
+  auto pipeline = [&]() {
+    return range(0, n).select([](int x) { return range(0, 512).map([x](int y) { return (x + y) % 5; }).sum(par(4, 8)) % 3 != x % 2; });
+  };
+  std::vector<int> expected, res;
+  pipeline().collect(expected);
+  for(int i = 0; i < 10; ++i) {
+    res.clear();
+    pipeline().collect(par(4, 10), res);
+    ASSERT_EQ(expected, res);
+  }
+} // ParCollect.Nested
+
+TEST(ParReduce, Sum) {
+  EXPECT_EQ(499999500000L, range(0L, 1000000L).sum(par));
+  EXPECT_EQ(499999500000L, range(0L, 1000000L).sum(par(3, 1000), reduction::pairwise));
+  std::vector<double> v(1000000, 0.1);
+  EXPECT_NEAR(100000.0, container(v).sum(par, reduction::compensated), 1e-9);
+  EXPECT_NEAR(std::pow(1.0001, 10000), container(std::vector<double>(10000, 1.0001)).product(par(4, 100)), 1e-10);
+} // ParReduce.Sum
+
+TEST(ParReduce, Reproducible) {
+  std::vector<double> v(100003);
+  for(size_t i = 0; i < v.size(); ++i)
+    v[i] = std::sin((double)i) * std::pow(10.0, (double)(i % 13) - 6);
+  const double exp = container(v).sum(reduction::reproducible);
+  EXPECT_NEAR(container(v).sum(reduction::compensated), exp, 1e-6);
+  for(unsigned t : { 1, 2, 3, 4 }) {
+    for(size_t g : { 0, 1, 5000, 30000 }) {
+      par_stats stats;
+      EXPECT_EQ(exp, container(v).sum(par(t, g, &stats), reduction::reproducible)) << t << ' ' << g;
+      EXPECT_EQ((size_t)0, stats.grain % reproducible_block);
+    }
+  }
+
+  // Blocks of positions of the source, not of the elements selected
+  auto positive = [](double x) { return x > 0; };
+  const double pos = container(v).select(positive).sum(reduction::reproducible);
+  EXPECT_EQ(pos, container(v).select(positive).sum(par(4, 1), reduction::reproducible));
+  EXPECT_EQ(pos, container(v).select(positive).sum(par(3), reduction::reproducible));
+
+  std::vector<double> w(20000, 1.0001);
+  const double prod = container(w).product(reduction::reproducible);
+  EXPECT_NEAR(std::pow(1.0001, 20000), prod, 1e-9);
+  EXPECT_EQ(prod, container(w).product(par(4, 100), reduction::reproducible));
+  EXPECT_EQ(0.0, container(std::vector<double>()).sum(par, reduction::reproducible));
+} // ParReduce.Reproducible
+
+TEST(ParReduce, Monoid) {
+  auto concat = make_monoid(std::string(), [](const std::string& x, const std::string& y) { return x + y; });
+  std::string exp;
+  for(int i = 0; i < 2000; ++i)
+    exp += std::to_string(i % 10);
+  EXPECT_EQ(exp, range(0, 2000).map([](int x) { return std::to_string(x % 10); }).reduce(par(4, 10), concat));
+  auto max = make_monoid(0, [](int x, int y) { return std::max(x, y); }, true);
+  EXPECT_EQ(99999, range(0, 100000).reduce(par, max));
+} // ParReduce.Monoid
+
+} // namespace
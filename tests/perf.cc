@@ -0,0 +1,43 @@
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <Enumerable/perf.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+TEST(Perf, Profile) {
+  perf_counters pc;
+  const long sum = profile(pc, range(0L, 1000000L).select([](long x) { return x % 3 == 0; }),
+                           [](auto e) { return e.inject(0L, [](long a, long x) { return a + x; }); });
+  EXPECT_EQ(166666833333L, sum);
+  EXPECT_EQ((uint64_t)333334, pc.elements);
+  EXPECT_LT(0.0, pc.seconds);
+  if(pc.valid[perf_counters::instructions]) {
+    EXPECT_LT((uint64_t)1000000, pc[perf_counters::instructions]); // At least one per element of the range
+    EXPECT_LT(0.0, pc.per_element(perf_counters::instructions));
+  }
+  if(pc.valid[perf_counters::cycles] && pc.valid[perf_counters::instructions]) {
+    EXPECT_LT(0.0, pc.ipc());
+  }
+
+  std::ostringstream os;
+  pc.print(os);
+  EXPECT_EQ(0u, os.str().find("time "));
+  EXPECT_NE(std::string::npos, os.str().find(pc.available() ? "/elt" : "[no perf counters]"));
+} // Perf.Profile
+
+TEST(Perf, Scope) {
+  perf_counters pc;
+  size_t n;
+  {
+    perf_scope scope(pc);
+    n = times(1000).count();
+    scope.stop();
+    EXPECT_LT(0.0, pc.seconds);
+  }
+  EXPECT_EQ((size_t)1000, n);
+  EXPECT_EQ((uint64_t)0, pc.elements);
+} // Perf.Scope
+
+} // namespace
@@ -0,0 +1,126 @@
+#include <chrono>
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <Enumerable/parallel.hpp>
+#include <Enumerable/probe.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+const bool pool_configured = (configure_pool(pool_options{ 4 }), true);
+
+// Line of the text report for probe name
+std::vector<std::string> report_line(const std::string& name) {
+  std::ostringstream os;
+  probe_report(os);
+  std::istringstream is(os.str());
+  std::vector<std::string> res;
+  std::string line;
+  while(std::getline(is, line)) {
+    if(line.compare(0, name.size() + 1, name + '\t') != 0) continue;
+    std::istringstream ls(line);
+    for(std::string field; std::getline(ls, field, '\t'); )
+      res.push_back(field);
+  }
+  return res;
+}
+
+TEST(Probe, Pipeline) {
+  configure_probes(probe_options{ 4 });
+  std::vector<int> v;
+  times(1000).probe("src").map([](int x) { return x * 3; }).probe("map")
+    .select([](int x) { return x % 2 == 0; }).probe("select").collect(v);
+  EXPECT_EQ((size_t)500, v.size());
+
+  auto src = report_line("src");
+  auto map = report_line("map");
+  auto sel = report_line("select");
+  ASSERT_EQ((size_t)6, src.size());
+  ASSERT_EQ((size_t)6, map.size());
+  ASSERT_EQ((size_t)6, sel.size());
+  EXPECT_EQ("1000", src[1]);
+  EXPECT_EQ("1000", map[1]);
+  EXPECT_EQ("500", sel[1]);
+  EXPECT_EQ(1.0, std::stod(map[5]));
+  EXPECT_EQ(0.5, std::stod(sel[5]));
+  EXPECT_LE(0.0, std::stod(sel[2]));
+
+  std::ostringstream os;
+  probe_report(os, probe_format::json);
+  const std::string json = os.str();
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"select\", \"upstream\": \"map\", \"count\": 500"));
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"src\", \"upstream\": null, \"count\": 1000"));
+
+  // Same name: accumulated
+  times(10).probe("src").count();
+  EXPECT_EQ("1010", report_line("src")[1]);
+  probe_reset();
+  EXPECT_EQ("0", report_line("src")[1]);
+  EXPECT_THROW(configure_probes(probe_options{ 3 }), std::invalid_argument);
+  configure_probes(probe_options());
+} // Probe.Pipeline
+
+TEST(Probe, Upstream) {
+  probe_reset();
+  std::string json;
+  auto report = [&]() {
+    std::ostringstream os;
+    probe_report(os, probe_format::json);
+    json = os.str();
+  };
+  // The upstream probe is the one in the pipeline, not the last one
+  // created. The counts are added when the probes are destroyed.
+  {
+    auto a  = times(100).probe("up_a");
+    auto b  = times(50).probe("up_b");
+    auto am = a.map([](int x) { return x + 1; }).probe("up_a_map");
+    auto bm = b.select([](int x) { return x % 2 == 0; }).probe("up_b_select");
+    EXPECT_EQ((size_t)100, am.count());
+    EXPECT_EQ((size_t)25, bm.count());
+  }
+  report();
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"up_a_map\", \"upstream\": \"up_a\", \"count\": 100,"));
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"up_b_select\", \"upstream\": \"up_b\", \"count\": 25,"));
+
+  // Same name, different upstream probes: different statistics
+  times(10).probe("up_x").probe("up_y").count();
+  times(20).probe("up_z").probe("up_y").count();
+  times(30).probe("up_y").count();
+  report();
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"up_y\", \"upstream\": \"up_x\", \"count\": 10,"));
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"up_y\", \"upstream\": \"up_z\", \"count\": 20,"));
+  EXPECT_NE(std::string::npos, json.find("{\"name\": \"up_y\", \"upstream\": null, \"count\": 30,"));
+} // Probe.Upstream
+
+TEST(Probe, SlowMap) {
+  // The work of a map is done when dereferenced: it must be in the
+  // time of its probe.
+  configure_probes(probe_options{ 4 });
+  size_t calls = 0;
+  auto   slow  = [&](int x) {
+    ++calls;
+    const auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(20);
+    while(std::chrono::steady_clock::now() < end) ;
+    return x;
+  };
+  EXPECT_EQ(1999000, times(2000).probe("fast_src").map(slow).probe("slow_map").sum());
+  EXPECT_EQ((size_t)2000, calls); // Not dereferenced twice
+  const double self = std::stod(report_line("slow_map")[3]);
+  EXPECT_LT(0.01, self); // 40ms in total
+  EXPECT_LT(10 * std::stod(report_line("fast_src")[3]), self);
+  configure_probes(probe_options());
+} // Probe.SlowMap
+
+TEST(Probe, Parallel) {
+  auto e = range(0, 100000).probe("par_src").select([](int x) { return x % 4 == 0; }).probe("par_select");
+  std::atomic<long> sum(0);
+  e.each(par(4, 1000), [&](int x) { sum += x; });
+  EXPECT_EQ(1249950000L, sum.load());
+  EXPECT_EQ("100000", report_line("par_src")[1]);
+  EXPECT_EQ("25000", report_line("par_select")[1]);
+  EXPECT_EQ(0.25, std::stod(report_line("par_select")[5]));
+} // Probe.Parallel
+
+} // namespace
@@ -1,3 +1,11 @@
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+
 #include <gtest/gtest.h>
 #include <Enumerable.hpp>
 
@@ -16,6 +24,28 @@ TEST(Range, Step) {
   EXPECT_EQ(exp, v);
 } // Range.Step
 
+TEST(Range, Size) {
+  EXPECT_EQ((size_t)4, range(-5, 2, 2).size());
+  EXPECT_EQ((size_t)std::numeric_limits<int>::max() + 10, range(-10).size());
+  EXPECT_EQ((size_t)std::numeric_limits<int>::max() - (size_t)std::numeric_limits<int>::min(),
+            range(std::numeric_limits<int>::min()).size());
+  auto r     = range(-10);
+  auto first = r.split(15);
+  EXPECT_EQ(-45, first.sum());
+  EXPECT_EQ(5, *r);
+
+  // Floating point: not splittable, the size would not match the
+  // repeated additions
+  EXPECT_FALSE(imp::is_splittable<decltype(range(0.0, 1.0, 0.1))>::value);
+  EXPECT_EQ((size_t)11, range(0.0, 1.0, 0.1).count());
+} // Range.Size
+
+TEST(Range, NonPositiveStep) {
+  EXPECT_THROW(range(0, 10, 0), std::invalid_argument);
+  EXPECT_THROW(range(0.0, 1.0, -0.1), std::invalid_argument);
+  EXPECT_EQ((size_t)0, range(10, 5, -1).count());
+} // Range.NonPositiveStep
+
 
 TEST(Range, map) {
   std::vector<int> v, exp {3, 5, 7, 9, 11, 13};
@@ -71,12 +101,140 @@ TEST(Times, Drop) {
 } // Times.Drop
 
 
+TEST(Times, FilterMap) {
+  std::vector<int> v, exp{0, 4, 16, 36};
+  times(8).filter_map([](int x) { return x % 2 ? std::optional<int>() : std::optional<int>(x * x); }).collect(v);
+  EXPECT_EQ(exp, v);
+} // Times.FilterMap
+
+TEST(Times, Fusion) {
+  // Stages after a map or select are composed in a single FilterMap
+  auto e = times(20)
+    .map([](int x) { return x * 3; })
+    .select([](int x) { return x % 2 == 0; })
+    .map([](int x) { return std::to_string(x); })
+    .reject([](const std::string& s) { return s.size() > 1; })
+    .filter_map([](const std::string& s) { return s == "0" ? std::optional<char>() : std::optional<char>(s[0]); });
+  static_assert(std::is_same<decltype(e), imp::FilterMap<imp::Range<int>, typename decltype(e)::block_type>>::value, "fused");
+  std::vector<char> v, exp{'6'};
+  e.collect(v);
+  EXPECT_EQ(exp, v);
+
+  // The element held by a select goes through the fused stages
+  auto s = times(10).select([](int x) { return x > 2; });
+  EXPECT_EQ(3, *s);
+  std::vector<int> w, exp2{6, 10, 14, 18};
+  s.map([](int x) { return 2 * x; }).reject([](int x) { return x % 4 == 0; }).collect(w);
+  EXPECT_EQ(exp2, w);
+
+  // each and inject of a FilterMap, starting from the element held
+  auto f = times(10).select([](int x) { return x > 2; }).map([](int x) { return 2 * x; });
+  EXPECT_EQ(6, *f);
+  EXPECT_EQ(84, f.inject(0, [](int a, int x) { return a + x; }));
+  EXPECT_FALSE(f);
+  EXPECT_EQ(84, times(10).filter_map([](int x) { return x > 2 ? std::optional<int>(2 * x) : std::nullopt; })
+            .inject(0, [](int& a, int x) { a += x; return a; }));
+  auto odd = [](std::tuple<int, int> t) { return std::get<0>(t) % 2 == 1; };
+  EXPECT_EQ(10, zip(times(5), range(1, 6)).map([](std::tuple<int, int> t) { return t; }).select(odd)
+            .inject(0, [](int a, int x, int y) { return a + x + y; }));
+  int sum = 0;
+  zip(times(5), range(1, 6)).map([](std::tuple<int, int> t) { return t; }).select(odd)
+    .each([&](int x, int y) { sum += x * y; });
+  EXPECT_EQ(14, sum);
+} // Times.Fusion
+
 TEST(Container, Inject) {
   std::vector<int> i{1, 5, 6};
   auto res = container(i).inject(0, [](auto a, auto x) { return a + x; });
   EXPECT_EQ(12, res);
 } // Container.inject
 
+TEST(Container, InjectMove) {
+  // Move only accumulator: moved into the block and back
+  auto p = times(100).inject(std::make_unique<std::vector<int>>(), [](std::unique_ptr<std::vector<int>> a, int x) {
+      a->push_back(x);
+      return a;
+    });
+  EXPECT_EQ((size_t)100, p->size());
+  EXPECT_EQ(99, p->back());
+
+  std::string start("x");
+  EXPECT_EQ("x012", times(3).inject(start, [](std::string a, int x) { a += std::to_string(x); return a; }));
+  EXPECT_EQ("x", start);
+} // Container.InjectMove
+
+TEST(Container, InjectRef) {
+  // Block taking the accumulator by non-const reference
+  EXPECT_EQ(10, times(5).inject(0, [](int& a, int x) { a += x; return a; }));
+  EXPECT_EQ(25, zip(times(5), times(5)).inject(0, [](int& a, int x, int y) { a += x + y + 1; return a; }));
+  EXPECT_EQ(20, zip(times(5), times(5)).inject(0, [](int a, int x, int y) { return a + x + y; }));
+} // Container.InjectRef
+
+TEST(Container, EachWithObject) {
+  std::vector<int> v;
+  std::vector<int>& r = range(0, 5).each_with_object(v, [](std::vector<int>& a, int x) { a.push_back(x * x); });
+  EXPECT_EQ(&v, &r);
+  EXPECT_EQ((std::vector<int> {0, 1, 4, 9, 16}), v);
+
+  auto m = zip(times(3), range(10, 13)).each_with_object(std::map<int, int>(), [](std::map<int, int>& a, int x, int y) { a[x] = y; });
+  EXPECT_EQ((std::map<int, int> {{0, 10}, {1, 11}, {2, 12}}), m);
+} // Container.EachWithObject
+
+TEST(Container, Sum) {
+  EXPECT_EQ(4950, times(100).sum());
+  EXPECT_EQ(4950L, times(100).sum<long>(reduction::pairwise));
+  EXPECT_EQ(0, times(0).sum());
+  EXPECT_EQ(15u, range(0u, 6u).sum());
+  EXPECT_EQ(3628800, range(1, 11).product());
+  EXPECT_EQ(3628800, range(1, 11).product(reduction::reassociate));
+  for(int n : { 0, 1, 7, 8, 9, 255, 256, 257, 1000 })
+    EXPECT_EQ(n * (n - 1) / 2, times(n).sum(reduction::pairwise)) << n;
+
+  std::vector<double> v(1000000, 0.1);
+  const double ordered = container(v).sum();
+  EXPECT_EQ(ordered, container(v).inject(0.0, [](double a, double x) { return a + x; }));
+  EXPECT_NEAR(100000.0, container(v).sum(reduction::reassociate), 1e-6);
+  const double pairwise    = container(v).sum(reduction::pairwise);
+  const double compensated = container(v).sum(reduction::compensated);
+  EXPECT_LT(std::abs(pairwise - 100000.0), std::abs(ordered - 100000.0));
+  EXPECT_LE(std::abs(compensated - 100000.0), std::abs(pairwise - 100000.0));
+  EXPECT_NEAR(100000.0, compensated, 1e-9);
+
+  std::vector<double> w { 1.0, 1e100, 1.0, -1e100 };
+  EXPECT_EQ(0.0, container(w).sum());
+  EXPECT_EQ(2.0, container(w).sum(reduction::compensated));
+} // Container.Sum
+
+TEST(Container, Reduce) {
+  auto max = make_monoid(std::numeric_limits<int>::min(), [](int x, int y) { return std::max(x, y); }, true);
+  std::vector<int> v { 3, 5, 2, 10, 1, 7, 8, 4, 6, 9, 0 };
+  EXPECT_EQ(10, container(v).reduce(max));
+  EXPECT_EQ(std::numeric_limits<int>::min(), times(0).reduce(max));
+
+  // Not commutative: in order
+  auto concat = make_monoid(std::string(), [](const std::string& x, const std::string& y) { return x + y; });
+  EXPECT_EQ("0123456789", times(10).map([](int x) { return std::to_string(x); }).reduce(concat));
+} // Container.Reduce
+
+TEST(Container, Fanout) {
+  std::vector<int> v { 3, 5, 2, 10, 1 }, copy;
+  std::set<int>    set;
+  auto res = container(v).fanout(reducer::count(), reducer::min(), reducer::max(), reducer::sum<long>(),
+                                 reducer::collect(copy), reducer::insert(set),
+                                 reducer::inject(std::string(), [](std::string a, int x) { return a + std::to_string(x); }));
+  EXPECT_EQ((size_t)5, std::get<0>(res));
+  EXPECT_EQ(1, std::get<1>(res));
+  EXPECT_EQ(10, std::get<2>(res));
+  EXPECT_EQ(21L, std::get<3>(res));
+  EXPECT_EQ(&copy, &std::get<4>(res));
+  EXPECT_EQ(v, copy);
+  EXPECT_EQ((std::set<int> { 1, 2, 3, 5, 10 }), set);
+  EXPECT_EQ("352101", std::get<6>(res));
+
+  auto empty = times(0).fanout(reducer::count(), reducer::max(), reducer::sum());
+  EXPECT_EQ(std::make_tuple((size_t)0, 0, 0), empty);
+} // Container.Fanout
+
 TEST(Container, Max) {
   std::vector<int> i{3, 5, 2, 10, 1}, e;
   auto res = container(i).max();
@@ -102,6 +260,15 @@ TEST(Lines, Count) {
   EXPECT_EQ((size_t)2, lines(is).count());
 } // Lines.ForLoop
 
+TEST(Lines, Fanout) {
+  // One pass over the stream
+  std::istringstream is("Hello\nCoucou\nA\n");
+  auto [count, max, min] = lines(is).fanout(reducer::count(), reducer::max(), reducer::min());
+  EXPECT_EQ((size_t)3, count);
+  EXPECT_EQ("Hello", max);
+  EXPECT_EQ("A", min);
+} // Lines.Fanout
+
 TEST(Lines, ForLoop) {
   std::istringstream is("hello\n# Comment\n\nVOila");
   auto ls = lines(is).reject([](auto& l) { return l.size() == 0 || l[0] == '#'; });
@@ -113,4 +280,173 @@ TEST(Lines, ForLoop) {
   EXPECT_EQ(filtered[1], "VOila");
 }
 
+AnyEnumerable<int> evens_or_odds(bool even) {
+  if(even)
+    return range(0, 10, 2);
+  return range(0, 10).select([](int x) { return x % 2 == 1; });
+}
+
+// Count the copies
+struct copy_count {
+  static int copies;
+  int        x;
+  copy_count(int x_) : x(x_) { }
+  copy_count(const copy_count& rhs) : x(rhs.x) { ++copies; }
+  copy_count& operator=(const copy_count& rhs) { x = rhs.x; ++copies; return *this; }
+};
+int copy_count::copies = 0;
+
+TEST(Zip, NoCopy) {
+  std::vector<copy_count> v1, v2;
+  for(int i = 0; i < 10; ++i) {
+    v1.emplace_back(i);
+    v2.emplace_back(2 * i);
+  }
+  copy_count::copies = 0;
+  int sum = 0;
+  zip(container(v1), container(v2), times(10)).each([&](const copy_count& x, const copy_count& y, int i) {
+      EXPECT_EQ(&v1[i], &x);
+      sum += x.x + y.x;
+    });
+  EXPECT_EQ(135, sum);
+  auto z = zip(container(v1), container(v2));
+  const auto& t = *z;
+  EXPECT_EQ(&v1[0], &std::get<0>(t));
+  EXPECT_EQ(0, copy_count::copies);
+
+  // Copied when stored as value_type
+  std::vector<std::tuple<copy_count, copy_count>> res;
+  zip(container(v1), container(v2)).collect(res);
+  EXPECT_EQ((size_t)10, res.size());
+  EXPECT_EQ(18, std::get<1>(res[9]).x);
+
+  std::istringstream is1("a\nbb\nccc\n"), is2("1\n2\n");
+  std::vector<std::tuple<std::string, std::string>> lines2, exp {{"a", "1"}, {"bb", "2"}};
+  zip(lines(is1), lines(is2)).collect(lines2);
+  EXPECT_EQ(exp, lines2);
+} // Zip.NoCopy
+
+TEST(Zip, Zipa) {
+  std::vector<copy_count> v1, v2;
+  for(int i = 0; i < 5; ++i) {
+    v1.emplace_back(i);
+    v2.emplace_back(i + 10);
+  }
+  copy_count::copies = 0;
+  int i = 0;
+  for(const auto& a : zipa(container(v1), container(v2))) {
+    EXPECT_EQ(&v1[i], &a[0]);
+    EXPECT_EQ(&v2[i], &*(a.begin() + 1));
+    EXPECT_EQ((size_t)2, a.size());
+    ++i;
+  }
+  EXPECT_EQ(5, i);
+  EXPECT_EQ(0, copy_count::copies);
+
+  // Enumerables returning values are copied into an array
+  std::vector<std::array<int, 3>> v, exp {{0, 5, 10}, {1, 6, 11}};
+  zipa(range(0, 2), range(5, 7), range(10, 12)).collect(v);
+  EXPECT_EQ(exp, v);
+} // Zip.Zipa
+
+// Enumerable of n copies of i, counting how many are alive
+struct counted : public imp::Base<counted, int> {
+  static std::atomic<int> alive, max_alive;
+  std::shared_ptr<int>    m_token;
+  int                     m_i, m_n;
+  typedef int value_type;
+  counted(int i, int n) : m_i(i), m_n(n) {
+    const int a = ++alive;
+    int m = max_alive;
+    while(a > m && !max_alive.compare_exchange_weak(m, a)) { }
+    m_token.reset(new int, [](int* p) { --alive; delete p; });
+  }
+  operator bool() const { return m_n > 0; }
+  void operator++() { --m_n; }
+  int operator*() const { return m_i; }
+};
+std::atomic<int> counted::alive(0), counted::max_alive(0);
+
+TEST(Cat, Runtime) {
+  for(size_t open : { 1, 2, 5 }) {
+    counted::max_alive = 0;
+    std::vector<int> v, exp;
+    for(int i = 0; i < 100; ++i)
+      for(int j = 0; j < i % 3; ++j)
+        exp.push_back(i);
+    cat_all(times(100).map([](int i) { return counted(i, i % 3); }), open).collect(v);
+    EXPECT_EQ(exp, v);
+    EXPECT_EQ(0, counted::alive);
+    EXPECT_LE(counted::max_alive, (int)open);
+  }
+
+  std::vector<imp::Range<int>> rs { range(0, 3), range(0, 0), range(10, 12) };
+  std::vector<int> v, exp { 0, 1, 2, 10, 11 };
+  cat(rs).collect(v);
+  EXPECT_EQ(exp, v);
+  EXPECT_EQ((size_t)0, cat(std::vector<imp::Range<int>>()).count());
+
+  // Stop early: the opener thread must stop
+  EXPECT_TRUE(cat_all(times(1000).map([](int i) { return counted(i, 1000); }), 4).any([](int x) { return x == 2; }));
+  EXPECT_EQ(0, counted::alive);
+} // Cat.Runtime
+
+TEST(Cat, SharedState) {
+  // Copies share the position
+  auto c  = cat_all(times(3).map([](int i) { return range(0, i + 1); }), 2);
+  auto c2 = c;
+  EXPECT_EQ(0, *c2);
+  ++c2;
+  ++c2;
+  EXPECT_EQ(1, *c); // In the second range
+  std::vector<int> v, exp { 1, 0, 1, 2 };
+  for(int x : c)
+    v.push_back(x);
+  EXPECT_EQ(exp, v);
+  EXPECT_FALSE(c);
+  EXPECT_FALSE(c2);
+} // Cat.SharedState
+
+TEST(Cat, Error) {
+  auto open = [](int i) {
+    if(i == 5) throw std::runtime_error("can't open");
+    return range(0, i);
+  };
+  for(size_t n : { 1, 3 }) {
+    size_t nb = 0;
+    EXPECT_THROW(cat_all(times(10).map(open), n).each([&](int) { ++nb; }), std::runtime_error);
+    EXPECT_EQ((size_t)10, nb); // All the elements before the error
+  }
+} // Cat.Error
+
+TEST(AnyEnumerable, Runtime) {
+  std::vector<int> v, exp {0, 2, 4, 6, 8};
+  evens_or_odds(true).collect(v);
+  EXPECT_EQ(exp, v);
+  EXPECT_EQ(25, evens_or_odds(false).inject(0, [](int a, int x) { return a + x; }));
+} // AnyEnumerable.Runtime
+
+TEST(AnyEnumerable, Container) {
+  std::vector<AnyEnumerable<int>> es;
+  es.push_back(times(1000));
+  es.push_back(range(0, 5).map([](int x) { return x * x; }));
+  std::vector<int> big(1000, 1); // Enumerable larger than the small buffer
+  es.push_back(zip(container(big), container(big), container(big), times(1000))
+               .map([](const std::tuple<int, int, int, int>& t) { return std::get<0>(t) + std::get<3>(t); }));
+  auto copy = es;
+  EXPECT_EQ((size_t)1000, es[0].count());
+  EXPECT_EQ(30, es[1].inject(0, [](int a, int x) { return a + x; }));
+  EXPECT_EQ(1000, es[2].max());
+  EXPECT_EQ((size_t)1000, copy[0].count());
+  EXPECT_EQ(1000, copy[2].max());
+} // AnyEnumerable.Container
+
+TEST(AnyEnumerable, Lines) {
+  std::istringstream is("a\n\nb\nc\n");
+  AnyEnumerable<const std::string> ls = lines(is);
+  std::vector<std::string> v, exp {"a", "b", "c"};
+  ls.select([](const std::string& l) { return !l.empty(); }).collect(v);
+  EXPECT_EQ(exp, v);
+} // AnyEnumerable.Lines
+
 } // namespace
@@ -0,0 +1,164 @@
+#include <fstream>
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <Enumerable/text.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+void write_file(const char* path, const std::string& content) {
+  std::ofstream os(path);
+  os << content;
+}
+
+template<typename Enum>
+std::vector<std::vector<std::string>> rows(Enum e) {
+  std::vector<std::vector<std::string>> res;
+  e.each([&](const imp::Row& r) {
+      res.emplace_back();
+      for(size_t i = 0; i < r.size(); ++i)
+        res.back().emplace_back(r[i]);
+    });
+  return res;
+}
+
+TEST(Fields, Lines) {
+  std::istringstream is("a\tb\tc\n\t1\n\nlast");
+  std::vector<std::vector<std::string>> exp { {"a", "b", "c"}, {"", "1"}, {""}, {"last"} };
+  EXPECT_EQ(exp, rows(lines(is).fields('\t')));
+} // Fields.Lines
+
+TEST(Fields, Long) {
+  std::string line;
+  std::vector<std::string> exp;
+  for(int i = 0; i < 100; ++i) {
+    exp.push_back(std::to_string(i * i));
+    line += (i ? "," : "") + exp.back();
+  }
+  std::istringstream is(line + "\n" + line + "\n");
+  EXPECT_EQ(std::vector<std::vector<std::string>>(2, exp), rows(lines(is).fields(',')));
+} // Fields.Long
+
+TEST(Fields, Quotes) {
+  std::istringstream is("\"a,b\",c,\"\"\n\"x\"\"y\",\"\",z\n");
+  std::vector<std::vector<std::string>> exp { {"a,b", "c", ""}, {"x\"\"y", "", "z"} };
+  EXPECT_EQ(exp, rows(lines(is).fields(',')));
+} // Fields.Quotes
+
+TEST(Fields, MappedLines) {
+  std::istringstream is("1 2\n3 4\n");
+  // Lines returned by value are kept by Fields
+  auto sum = lines(is).map([](const std::string& l) { return l + " 10"; })
+    .fields(' ').map([](const imp::Row& r) { return r.get<int>(0) + r.get<int>(1) + r.get<int>(2); })
+    .inject(0, [](int a, int x) { return a + x; });
+  EXPECT_EQ(30, sum);
+} // Fields.MappedLines
+
+TEST(Fields, Column) {
+  std::istringstream is("a 1 0.5\nb 2 1.5\nc 3 2.5\n");
+  EXPECT_EQ(6, lines(is).fields(' ').column<int>(1).inject(0, [](int a, int x) { return a + x; }));
+  std::istringstream is2("a 1 0.5\nb 2 1.5\nc 3 2.5\n");
+  EXPECT_DOUBLE_EQ(2.5, lines(is2).fields(' ').column<double>(2).max());
+  std::istringstream is3("a 1x\n");
+  EXPECT_THROW(lines(is3).fields(' ').column<int>(1).max(), std::invalid_argument);
+} // Fields.Column
+
+TEST(Fields, Select) {
+  std::istringstream is("a,1\nb,22\nc,3\nd,44\n");
+  auto long_value = [](const imp::Row& r) { return r[1].size() > 1; };
+  std::vector<std::vector<std::string>> exp { {"b", "22"}, {"d", "44"} };
+  EXPECT_EQ(exp, rows(lines(is).fields(',').select(long_value)));
+  std::istringstream is2("a,1\nb,22\nc,3\nd,44\n");
+  EXPECT_EQ(4, lines(is2).fields(',').reject(long_value).map([](const imp::Row& r) { return r.get<int>(1); }).inject(0, [](int a, int x) { return a + x; }));
+} // Fields.Select
+
+TEST(Csv, File) {
+  const char* path = "csv_file.csv";
+  file_unlink unlink(path);
+  write_file(path, "name,value\r\n\"multi\nline, field\",12\nplain,-3\nlast,\"7\"");
+  std::vector<std::vector<std::string>> exp {
+    {"name", "value"}, {"multi\nline, field", "12"}, {"plain", "-3"}, {"last", "7"} };
+  EXPECT_EQ(exp, rows(csv(path)));
+  EXPECT_EQ(16, csv(path).drop(1).column<int>(1).inject(0, [](int a, int x) { return a + x; }));
+} // Csv.File
+
+TEST(Csv, Select) {
+  const char* path = "csv_select.csv";
+  file_unlink unlink(path);
+  write_file(path, "x,1\n\"y,z\",2\nw,3\n\"v\",4\n");
+  auto even = [](const imp::Row& r) { return r.get<int>(1) % 2 == 0; };
+  std::vector<std::vector<std::string>> exp { {"y,z", "2"}, {"v", "4"} };
+  EXPECT_EQ(exp, rows(csv(path).select(even)));
+  EXPECT_EQ(exp, rows(csv(path).select(even).select([](const imp::Row& r) { return r.size() == 2; })));
+} // Csv.Select
+
+TEST(Csv, Large) {
+  const char* path = "csv_large.tsv";
+  file_unlink unlink(path);
+  std::uniform_int_distribution<long> dist(-1000000, 1000000);
+  std::ostringstream os;
+  long total = 0;
+  for(int i = 0; i < 10000; ++i) {
+    const long x = dist(rand_gen);
+    total += x;
+    os << "row" << i << '\t' << "\"quoted\tfield\"" << '\t' << x << '\n';
+  }
+  write_file(path, os.str());
+  EXPECT_EQ((size_t)10000, csv(path, '\t').count());
+  EXPECT_EQ(total, csv(path, '\t').column<long>(2).inject(0l, [](long a, long x) { return a + x; }));
+  EXPECT_TRUE(csv(path, '\t').all([](const imp::Row& r) { return r.size() == 3 && r[1] == "quoted\tfield"; }));
+} // Csv.Large
+
+TEST(Csv, Empty) {
+  const char* path = "csv_empty.csv";
+  file_unlink unlink(path);
+  write_file(path, "");
+  EXPECT_EQ((size_t)0, csv(path).count());
+} // Csv.Empty
+
+TEST(Numbers, Integers) {
+  std::istringstream is("1 -2\n  3\t123456789012 -9223372036854775808\n 9223372036854775807 12345678901234567890123\n");
+  std::vector<long> v;
+  EXPECT_THROW(numbers<long>(is).collect(v), std::invalid_argument); // Last one overflows
+  std::vector<long> exp {1, -2, 3, 123456789012, std::numeric_limits<long>::min(), std::numeric_limits<long>::max()};
+  EXPECT_EQ(exp, v);
+
+  EXPECT_EQ(600, numbers<int>("100 200\n300").inject(0, [](int a, int x) { return a + x; }));
+  EXPECT_EQ(255, numbers<unsigned char>("12 255 0").max());
+  EXPECT_THROW(numbers<unsigned char>("256").max(), std::invalid_argument);
+  EXPECT_THROW(numbers<unsigned>("-1").max(), std::invalid_argument);
+  EXPECT_THROW(numbers<int>("12a").max(), std::invalid_argument);
+  EXPECT_EQ((size_t)0, numbers<int>("  \n ").count());
+} // Numbers.Integers
+
+TEST(Numbers, Floats) {
+  EXPECT_DOUBLE_EQ(-1.5e10, numbers<double>("1 2.5 -1.5e10 1e-3").min());
+  EXPECT_THROW(numbers<double>("0x1").max(), std::invalid_argument);
+  EXPECT_DOUBLE_EQ(6.25, numbers<double>("1 2.5\n2.75").inject(0.0, [](double a, double x) { return a + x; }));
+} // Numbers.Floats
+
+TEST(Numbers, Chunks) {
+  // Small chunks: numbers span chunks boundaries
+  std::ostringstream os;
+  long total = 0;
+  std::uniform_int_distribution<long> dist(-1000000000000l, 1000000000000l);
+  for(int i = 0; i < 5000; ++i) {
+    const long x = dist(rand_gen);
+    total += x;
+    os << x << (i % 7 ? " " : "\n");
+  }
+  const char* path = "numbers_chunks.txt";
+  file_unlink unlink(path);
+  write_file(path, os.str());
+  for(size_t bs : { 3, 16, 4096 }) {
+    read_options opts;
+    opts.buffer_size = bs;
+    EXPECT_EQ(total, file_numbers<long>(path, opts).inject(0l, [](long a, long x) { return a + x; }));
+  }
+  std::istringstream is(os.str());
+  EXPECT_EQ(total, numbers<long>(is).inject(0l, [](long a, long x) { return a + x; }));
+} // Numbers.Chunks
+
+} // namespace
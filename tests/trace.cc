@@ -0,0 +1,80 @@
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+#include <gtest/gtest.h>
+#include <gtest/test.hpp>
+#include <Enumerable/parallel.hpp>
+
+namespace  {
+using namespace Enumerable;
+
+const bool pool_configured = (configure_pool(pool_options{ 4 }), true);
+
+std::string read_file(const char* path) {
+  std::ifstream is(path);
+  std::ostringstream os;
+  os << is.rdbuf();
+  return os.str();
+}
+
+size_t occurrences(const std::string& s, const std::string& pattern) {
+  size_t res = 0;
+  for(size_t pos = s.find(pattern); pos != std::string::npos; pos = s.find(pattern, pos + 1))
+    ++res;
+  return res;
+}
+
+TEST(Trace, Chunks) {
+  const char* path = "trace_chunks.json";
+  file_unlink unlink(path);
+  trace_clear();
+  par_stats stats;
+  std::atomic<long> sum(0);
+  range(0, 1000000).each(par(4, 1000, &stats), [&](int x) { sum += x; });
+  EXPECT_EQ(499999500000L, sum.load());
+  trace_write(path);
+
+  const std::string trace = read_file(path);
+  EXPECT_EQ(0u, trace.find("{\"displayTimeUnit\": \"ns\", \"traceEvents\": ["));
+  EXPECT_EQ("\n]}\n", trace.substr(trace.size() - 4));
+  EXPECT_EQ(stats.chunks, occurrences(trace, "\"name\": \"chunk\""));
+  EXPECT_EQ(stats.splits, occurrences(trace, "\"name\": \"split\""));
+  EXPECT_EQ(stats.steals, occurrences(trace, "\"name\": \"steal\""));
+  EXPECT_NE(std::string::npos, trace.find("\"args\": {\"name\": \"worker 0\"}"));
+} // Trace.Chunks
+
+TEST(Trace, Ring) {
+  const char* path = "trace_ring.json";
+  file_unlink unlink(path);
+  trace_clear();
+  configure_trace(16); // For the threads created after
+  std::thread th2([]() {
+      for(int i = 0; i < 100; ++i) {
+        ENUMERABLE_TRACE_SCOPE_ARG("step2", i);
+      }
+    });
+  th2.join();
+  trace_write(path);
+  const std::string trace = read_file(path);
+  EXPECT_EQ((size_t)16, occurrences(trace, "\"name\": \"step2\""));
+  EXPECT_NE(std::string::npos, trace.find("\"args\": {\"n\": 99}"));
+  EXPECT_EQ(std::string::npos, trace.find("\"args\": {\"n\": 83}")); // Overwritten
+  EXPECT_THROW(configure_trace(10), std::invalid_argument);
+} // Trace.Ring
+
+TEST(Trace, ThreadName) {
+  const char* path = "trace_thread_name.json";
+  file_unlink unlink(path);
+  trace_clear();
+  std::thread th([]() {
+      ENUMERABLE_TRACE_THREAD_NAME("quote \" backslash \\ tab \t");
+      ENUMERABLE_TRACE_INSTANT("named", 1);
+    });
+  th.join();
+  trace_write(path);
+  const std::string trace = read_file(path);
+  EXPECT_NE(std::string::npos, trace.find("\"args\": {\"name\": \"quote \\\" backslash \\\\ tab \\u0009\"}}"));
+} // Trace.ThreadName
+
+} // namespace